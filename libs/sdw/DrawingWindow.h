@@ -4,7 +4,9 @@
 #include <fstream>
 #include <vector>
 #include "SDL.h"
+#include "RenderTarget.h"
 
+// Shows a RenderTarget in an SDL window and passes on the window's input events
 class DrawingWindow {
 
 public:
@@ -15,18 +17,13 @@ private:
 	SDL_Window *window;
 	SDL_Renderer *renderer;
 	SDL_Texture *texture;
-	std::vector<uint32_t> pixelBuffer;
 
 public:
 	DrawingWindow();
-	DrawingWindow(int w, int h, bool fullscreen, bool shown);
-	void renderFrame();
-	void savePPM(const std::string &filename) const;
-	void saveBMP(const std::string &filename) const;
+	DrawingWindow(int w, int h, bool fullscreen);
+	void renderFrame(const RenderTarget &target);
+	void saveBMP(const RenderTarget &target, const std::string &filename) const;
 	bool pollForInputEvents(SDL_Event &event);
-	void setPixelColour(size_t x, size_t y, uint32_t colour);
-	uint32_t getPixelColour(size_t x, size_t y);
-	void clearPixels();
 };
 
 void printMessageAndQuit(const std::string &message, const char *error);
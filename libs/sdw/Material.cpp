@@ -0,0 +1,5 @@
+#include "Material.h"
+#include <utility>
+
+Material::Material(): specular(0.5f), shininess(16.f), reflectivity(0.f), backFaceCulling(false) {};
+Material::Material(std::string _name, Colour _diffuse): name(std::move(_name)), diffuse(std::move(_diffuse)), specular(0.5f), shininess(16.f), reflectivity(0.f), backFaceCulling(false) {};
\ No newline at end of file
@@ -0,0 +1,16 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <string>
+#include "Colour.h"
+
+struct Material {
+    std::string name;
+    Colour diffuse; // Kd
+    glm::vec3 specular; // Ks, scales the light colour in highlights
+    float shininess; // Ns
+    float reflectivity; // fraction of light a mirror reflects (refl), 0 for everything else
+    bool backFaceCulling; // the rasteriser skips triangles facing away from the camera (cull), off for everything else
+    Material();
+    Material(std::string name, Colour diffuse);
+};
\ No newline at end of file
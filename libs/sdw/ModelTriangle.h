@@ -3,17 +3,17 @@
 #include <glm/glm.hpp>
 #include <string>
 #include <array>
-#include "Colour.h"
+#include <cstdint>
 #include "TexturePoint.h"
 
 struct ModelTriangle {
 	std::array<glm::vec3, 3> vertices{};
 	std::array<TexturePoint, 3> texturePoints{};
-	Colour colour{};
     glm::vec3 surfaceNormal;
     std::array<glm::vec3, 3> vertexNormals{};
+    uint16_t materialId{}; // index into the scene's material table
 
 	ModelTriangle();
-	ModelTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, Colour trigColour);
+	ModelTriangle(const glm::vec3 &v0, const glm::vec3 &v1, const glm::vec3 &v2, uint16_t trigMaterialId);
 	friend std::ostream &operator<<(std::ostream &os, const ModelTriangle &triangle);
 };
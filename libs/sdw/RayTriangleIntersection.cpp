@@ -1,15 +1,17 @@
 #include "RayTriangleIntersection.h"
 
 RayTriangleIntersection::RayTriangleIntersection() = default;
-RayTriangleIntersection::RayTriangleIntersection(const glm::vec3 &point, float distance, const ModelTriangle &triangle, size_t index) :
+RayTriangleIntersection::RayTriangleIntersection(const glm::vec3 &point, float distance, float u, float v, size_t index, uint16_t material) :
 		intersectionPoint(point),
 		distanceFromCamera(distance),
-		intersectedTriangle(triangle),
-		triangleIndex(index) {}
+		u(u),
+		v(v),
+		triangleIndex(index),
+		materialId(material) {}
 
 std::ostream &operator<<(std::ostream &os, const RayTriangleIntersection &intersection) {
 	os << "Intersection is at [" << intersection.intersectionPoint[0] << "," << intersection.intersectionPoint[1] << "," <<
-	   intersection.intersectionPoint[2] << "] on triangle " << intersection.intersectedTriangle <<
+	   intersection.intersectionPoint[2] << "] on triangle " << intersection.triangleIndex <<
 	   " at a distance of " << intersection.distanceFromCamera;
 	return os;
 }
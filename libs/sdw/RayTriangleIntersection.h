@@ -2,15 +2,17 @@
 
 #include <glm/glm.hpp>
 #include <iostream>
-#include "ModelTriangle.h"
+#include <cstdint>
 
 struct RayTriangleIntersection {
 	glm::vec3 intersectionPoint;
 	float distanceFromCamera;
-	ModelTriangle intersectedTriangle;
+	float u; // barycentric weight of the triangle's second vertex
+	float v; // barycentric weight of the triangle's third vertex
 	size_t triangleIndex;
+	uint16_t materialId;
 
 	RayTriangleIntersection();
-	RayTriangleIntersection(const glm::vec3 &point, float distance, const ModelTriangle &triangle, size_t index);
+	RayTriangleIntersection(const glm::vec3 &point, float distance, float u, float v, size_t index, uint16_t material);
 	friend std::ostream &operator<<(std::ostream &os, const RayTriangleIntersection &intersection);
 };
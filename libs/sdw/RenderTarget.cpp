@@ -0,0 +1,108 @@
+#include <algorithm>
+#include <fstream>
+#include <iostream>
+#include "RenderTarget.h"
+#ifdef __SSSE3__
+#include <immintrin.h>
+#endif
+RenderTarget::RenderTarget() : width(0), height(0), depthFrame(0), depthBlocksX(0) {}
+
+RenderTarget::RenderTarget(int w, int h) : width(w), height(h), pixelBuffer(w * h), depthFrame(0) {
+	// the depth buffer is only ever cleared in full here, as it is allocated
+	depthBlocksX = (width + depthBlockSize - 1) / depthBlockSize;
+	size_t depthBlocksY = (height + depthBlockSize - 1) / depthBlockSize;
+	depthBlocks.assign(depthBlocksX * depthBlocksY, DepthBlock());
+	depthBlockFrames.assign(depthBlocks.size(), depthFrame);
+	depthBlockFarthest.assign(depthBlocks.size(), 0.f);
+}
+
+// False if the file could not be written in full. The whole file is built in memory first so it goes to the disk in one write
+bool RenderTarget::savePPM(const std::string &filename) const {
+	std::ofstream outputStream(filename, std::ofstream::out | std::ofstream::binary);
+	if (!outputStream) {
+		std::cout << "Could not write " << filename << std::endl;
+		return false;
+	}
+	std::string header = "P6\n" + std::to_string(width) + " " + std::to_string(height) + "\n255\n";
+	std::vector<char> file(header.size() + 3 * width * height);
+	std::copy(header.begin(), header.end(), file.begin());
+	packRGB(0, width * height, reinterpret_cast<uint8_t *>(&file[header.size()]));
+	outputStream.write(file.data(), (std::streamsize) file.size());
+	outputStream.close();
+	return !outputStream.fail();
+}
+
+// Pixels [first, first + count) in row order, dropping the alpha byte of each to leave red, green and blue bytes
+void RenderTarget::packRGB(size_t first, size_t count, uint8_t *rgb) const {
+	const uint32_t *pixels = pixelBuffer.data() + first;
+	size_t i = 0;
+#ifdef __SSSE3__
+	// 4 pixels at a time, shuffled into 12 bytes. Each 16 byte store runs 4 bytes into the next pixels, so stops 6 pixels short of the end
+	const __m128i shuffle = _mm_setr_epi8(2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1);
+	for (; i + 6 <= count; i += 4) {
+		__m128i argb = _mm_loadu_si128(reinterpret_cast<const __m128i *>(pixels + i));
+		_mm_storeu_si128(reinterpret_cast<__m128i *>(rgb + 3 * i), _mm_shuffle_epi8(argb, shuffle));
+	}
+#endif
+	for (; i < count; i++) {
+		rgb[3 * i] = (uint8_t) (pixels[i] >> 16);
+		rgb[3 * i + 1] = (uint8_t) (pixels[i] >> 8);
+		rgb[3 * i + 2] = (uint8_t) pixels[i];
+	}
+}
+
+// Pixels off the target are skipped without a word, as headless stdout carries the frames saved and can't take a line per pixel
+void RenderTarget::setPixelColour(size_t x, size_t y, uint32_t colour) {
+	if ((x < width) && (y < height)) pixelBuffer[(y * width) + x] = colour;
+}
+
+// 0xFFFFFFFF for a pixel off the target
+uint32_t RenderTarget::getPixelColour(size_t x, size_t y) {
+	if ((x >= width) || (y >= height)) return -1;
+	return pixelBuffer[(y * width) + x];
+}
+
+// Unchecked, for code that writes whole spans of a row at once
+uint32_t *RenderTarget::getPixelRow(size_t y) {
+	return &pixelBuffer[y * width];
+}
+
+// Every pixel, row by row, as 0xAARRGGBB
+const uint32_t *RenderTarget::getPixels() const {
+	return pixelBuffer.data();
+}
+
+void RenderTarget::clearPixels() {
+	std::fill(pixelBuffer.begin(), pixelBuffer.end(), 0);
+}
+
+// Unchecked. A block left over from an earlier frame is cleared the first time it is asked for, so blocks nothing is drawn in are never touched
+float *RenderTarget::getDepthBlock(size_t blockX, size_t blockY) {
+	size_t block = blockY * depthBlocksX + blockX;
+	if (depthBlockFrames[block] != depthFrame) {
+		std::fill_n(depthBlocks[block].depth, depthBlockSize * depthBlockSize, 0.f);
+		depthBlockFrames[block] = depthFrame;
+		depthBlockFarthest[block] = 0.f;
+	}
+	return depthBlocks[block].depth;
+}
+
+// Unchecked. 0 for a block that has not been drawn in this frame
+float RenderTarget::getFarthestDepth(size_t blockX, size_t blockY) const {
+	size_t block = blockY * depthBlocksX + blockX;
+	return depthBlockFrames[block] == depthFrame ? depthBlockFarthest[block] : 0.f;
+}
+
+// Unchecked. Only valid for a block that getDepthBlock has handed out this frame
+void RenderTarget::setFarthestDepth(size_t blockX, size_t blockY, float depth) {
+	depthBlockFarthest[blockY * depthBlocksX + blockX] = depth;
+}
+
+// Empties the depth buffer without touching it, by moving on to a new frame
+void RenderTarget::clearDepth() {
+	depthFrame++;
+	if (depthFrame == 0) {
+		// wrapped around, blocks last cleared 2^32 frames ago would look current
+		std::fill(depthBlockFrames.begin(), depthBlockFrames.end(), UINT32_MAX);
+	}
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// The frame being drawn, in memory only. A DrawingWindow can show it, but nothing here needs SDL or a display
+class RenderTarget {
+
+public:
+	static const int depthBlockSize = 8;
+	// Depth of an 8x8 block of pixels, row by row. 0 is empty, larger values are closer
+	struct alignas(32) DepthBlock {
+		float depth[depthBlockSize * depthBlockSize];
+	};
+	size_t width;
+	size_t height;
+
+private:
+	std::vector<uint32_t> pixelBuffer;
+	std::vector<DepthBlock> depthBlocks; // blocks of each row of blocks are next to each other
+	std::vector<uint32_t> depthBlockFrames; // frame each block was last cleared in
+	std::vector<float> depthBlockFarthest; // smallest depth in each block, anything further away than it there is hidden
+	uint32_t depthFrame;
+	size_t depthBlocksX;
+
+public:
+	RenderTarget();
+	RenderTarget(int w, int h);
+	bool savePPM(const std::string &filename) const;
+	void packRGB(size_t first, size_t count, uint8_t *rgb) const;
+	void setPixelColour(size_t x, size_t y, uint32_t colour);
+	uint32_t getPixelColour(size_t x, size_t y);
+	uint32_t *getPixelRow(size_t y);
+	const uint32_t *getPixels() const;
+	void clearPixels();
+	float *getDepthBlock(size_t blockX, size_t blockY);
+	float getFarthestDepth(size_t blockX, size_t blockY) const;
+	void setFarthestDepth(size_t blockX, size_t blockY, float depth);
+	void clearDepth();
+};
@@ -4,7 +4,7 @@
 #include <string>
 #include <vector>
 #include <map>
-#include "DrawingWindow.h"
+#include "RenderTarget.h"
 #include "CanvasPoint.h"
 #include "CanvasTriangle.h"
 #include "ModelTriangle.h"
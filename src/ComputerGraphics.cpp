@@ -1,12 +1,18 @@
 #include <CanvasPoint.h>
 #include <ModelTriangle.h>
 #include <glm/glm.hpp>
+#include <charconv>
+#include <string>
 #include <vector>
 #include "Camera.h"
 #include "Scene.h"
 #include "FilesUtils.h"
-#include "EventUtils.h"
 #include "RenderUtils.h"
+#include "BenchmarkUtils.h"
+#ifndef HEADLESS_ONLY
+#include <DrawingWindow.h>
+#include "EventUtils.h"
+#endif
 
 #define WIDTH 480
 #define HEIGHT 480
@@ -48,7 +54,9 @@ void printInstructions() {
     "MISC: " << std::endl <<
     "R: Toggle mirror" << std::endl <<
     "X: Toggle soft shadows" << std::endl <<
+    "I: Toggle anti-aliased lines" << std::endl <<
     "F: Save as file" << std::endl <<
+    "P: Print last frame stats" << std::endl <<
     "=================================" << std::endl;
 }
 
@@ -59,28 +67,64 @@ Scene initScene(bool show, bool mirror, Scene::RenderMode renderMode, Light ligh
     std::string objFileName = "cornell-box.obj";
     //std::string objFileName = "sphere.obj";
     std::string mtlFileName = "cornell-box.mtl";
+    std::string cacheFileName = objFileName + ".cache";
     Camera camera(w, h, initialPosition, false);
-    std::vector<ModelTriangle> triangles = FilesUtils::loadOBJ(objFileName, mtlFileName);
-    Scene scene(w, h, show, mirror, renderMode, light, triangles, camera);
+    std::vector<Material> materials;
+    Geometry geometry;
+    BVH bvh;
+    // the cache holds the scene as it is after the constructor has built it, so only a changed model pays for that again
+    uint64_t sourceHash = FilesUtils::hashSceneSources(objFileName, mtlFileName, camera.model);
+    if (FilesUtils::readSceneCache(cacheFileName, sourceHash, geometry, materials, bvh)) {
+        return Scene(w, h, show, mirror, renderMode, light, std::move(geometry), std::move(materials), std::move(bvh), camera);
+    }
+    ThreadPool loaderThreads(ThreadPool::defaultThreadCount());
+    geometry = FilesUtils::loadOBJ(objFileName, mtlFileName, materials, loaderThreads);
+    Scene scene(w, h, show, mirror, renderMode, light, std::move(geometry), std::move(materials), camera);
+    FilesUtils::writeSceneCache(cacheFileName, sourceHash, *scene.geometry, scene.materials, *scene.bvh);
     return scene;
 }
 
+#ifndef HEADLESS_ONLY
+/// @brief Opens a window on the scene and redraws it as keys are pressed, until the window is closed
 void showScene(Scene &scene) {
+    DrawingWindow window((int) scene.width, (int) scene.height, false);
     SDL_Event event;
+    printInstructions();
     scene.draw();
     while (true) {
-        if (scene.show) {
-            if (scene.window.pollForInputEvents(event)) EventUtils::handleEvent(event, scene);
-            if (scene.camera.orbit) {
-                scene.camera.rotate(Camera::Axis::y, 1.f);
-                scene.draw();
-            }
+        if (window.pollForInputEvents(event)) EventUtils::handleEvent(event, scene);
+        if (scene.camera.orbit) {
+            scene.camera.rotate(Camera::Axis::y, 1.f);
+            scene.draw();
         }
-        scene.window.renderFrame();
+        window.renderFrame(scene.target);
     }
 }
+#endif
 
-void run(bool show) {
+/// @brief Reads the whole of text as a whole number of at least minimum, false if it is anything else
+template <typename T>
+bool parseNumber(const std::string &text, T minimum, T &value) {
+    T parsed;
+    std::from_chars_result result = std::from_chars(text.data(), text.data() + text.size(), parsed);
+    if (result.ec != std::errc() || result.ptr != text.data() + text.size() || parsed < minimum) return false;
+    value = parsed;
+    return true;
+}
+
+/// @brief What to draw and how, from the command line
+struct Options {
+    bool show;
+    int threadCount;
+    RenderUtils::FrameRange frames; // of the sequence, when drawing headless
+    size_t shardIndex = 0;
+    size_t shardCount = 0; // 0 unless --shard picks the frames instead
+    int workerCount = 0; // processes to hand the sequence out to, rather than drawing any of it here
+    ImageUtils::Format format = ImageUtils::PPM; // of the frames saved
+    std::string program; // this executable, which the workers run
+};
+
+int run(const Options &options) {
     Scene::RenderMode renderMode = Scene::RAY_TRACED;
     glm::vec3 lightColour = {255.f, 255.f, 255.f};
     float ambientIntensity = 0.15f;
@@ -92,21 +136,93 @@ void run(bool show) {
     //glm::vec3 lightSource(0.8, 0.8, -0.8);
     //glm::vec3 lightSource(0.0, 0.55, 0.7);
     bool enableMirror = false;
+    if (options.workerCount > 0) {
+        // splits the machine's threads between the workers, as they each load the scene for themselves
+        int threadsPerWorker = std::max(1, options.threadCount / options.workerCount);
+        return RenderUtils::coordinate(options.program, sequence, options.workerCount, threadsPerWorker, options.format) ? 0 : 1;
+    }
     Light light(lightSource, lightMode, ambientIntensity, lightColour);
     light.softShadows = false;
     glm::vec3 initialPosition(0.f, 0.f, 4.f);
     //glm::vec3 initialPosition(-0.03f,0.39f,2.29f);
     //glm::vec3 initialPosition(0.f, 0.35f, 3.1f);
-    Scene scene = initScene(show, enableMirror, renderMode, light, initialPosition);
-    printInstructions();
+    Scene scene = initScene(options.show, enableMirror, renderMode, light, initialPosition);
+    scene.setThreadCount(options.threadCount);
+#ifndef HEADLESS_ONLY
     if (scene.show) {
         showScene(scene);
-    } else {
-        RenderUtils::generate(scene, sequence);
+        return 0;
     }
+#endif
+    RenderUtils::FrameRange frames = options.frames;
+    if (options.shardCount > 0) frames = RenderUtils::shard(sequence, options.shardIndex, options.shardCount);
+    else if (frames.first >= RenderUtils::frameCount(sequence)) {
+        // a range past the end would draw nothing and look like it had succeeded
+        std::cout << "--frames starts at " << frames.first << ", past the " << RenderUtils::frameCount(sequence) << " frames of the sequence" << std::endl;
+        return 1;
+    }
+    // headless, every frame goes to output/ and nothing touches SDL
+    return RenderUtils::generate(scene, sequence, frames, options.format) ? 0 : 1;
 }
 
 int main(int argc, char *argv[]) {
-    bool show = true;
-    run(show);
+    if (argc == 3 && std::string(argv[1]) == "--benchmark") {
+        if (BenchmarkUtils::run(argv[2])) return 0;
+        std::cout << "Unknown benchmark: " << argv[2] << std::endl;
+        return 1;
+    }
+    Options options;
+#ifdef HEADLESS_ONLY
+    options.show = false; // built without SDL
+#else
+    options.show = true;
+#endif
+    options.threadCount = ThreadPool::defaultThreadCount();
+    options.program = argv[0];
+    for (int i=1; i<argc; i++) {
+        std::string arg = argv[i];
+        if (arg == "--threads" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], 1, options.threadCount)) {
+                std::cout << "Invalid --threads: " << argv[i] << ", expected a whole number from 1" << std::endl;
+                return 1;
+            }
+        } else if (arg == "--headless") options.show = false;
+        else if (arg == "--frames" && i + 1 < argc) {
+            // first:end, either left out for the start or end of the sequence
+            std::string range = argv[++i];
+            size_t colon = range.find(':');
+            std::string first = range.substr(0, colon);
+            std::string end = colon == std::string::npos ? "" : range.substr(colon + 1);
+            bool valid = colon != std::string::npos;
+            if (valid && !first.empty()) valid = parseNumber(first, (size_t) 0, options.frames.first);
+            if (valid && !end.empty()) valid = parseNumber(end, options.frames.first + 1, options.frames.end);
+            if (!valid) {
+                std::cout << "Invalid --frames: " << range << ", expected first:end with first before end" << std::endl;
+                return 1;
+            }
+            options.show = false;
+        } else if (arg == "--shard" && i + 1 < argc) {
+            // index/count, from 0
+            std::string shard = argv[++i];
+            size_t slash = shard.find('/');
+            bool valid = slash != std::string::npos && parseNumber(shard.substr(0, slash), (size_t) 0, options.shardIndex) && parseNumber(shard.substr(slash + 1), (size_t) 1, options.shardCount);
+            if (!valid || options.shardIndex >= options.shardCount) {
+                std::cout << "Invalid --shard: " << shard << ", expected index/count with index from 0 to count - 1" << std::endl;
+                return 1;
+            }
+            options.show = false;
+        } else if (arg == "--workers" && i + 1 < argc) {
+            if (!parseNumber(argv[++i], 1, options.workerCount)) {
+                std::cout << "Invalid --workers: " << argv[i] << ", expected a whole number from 1" << std::endl;
+                return 1;
+            }
+            options.show = false;
+        } else if (arg == "--format" && i + 1 < argc) {
+            if (!ImageUtils::parseFormat(argv[++i], options.format)) {
+                std::cout << "Unknown format: " << argv[i] << ", expected ppm, qoi or png" << std::endl;
+                return 1;
+            }
+        }
+    }
+    return run(options);
 }
\ No newline at end of file
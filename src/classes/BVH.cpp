@@ -0,0 +1,134 @@
+#include "BVH.h"
+#include <algorithm>
+#include <cfloat>
+
+namespace {
+    const int binCount = 16;
+    const uint32_t maxLeafSize = 8;
+    const float traversalCost = 1.f; // relative to the cost of one ray/triangle test
+}
+
+BVH::Bounds::Bounds(): min(FLT_MAX), max(-FLT_MAX) {}
+
+void BVH::Bounds::grow(glm::vec3 point) {
+    this->min = glm::min(this->min, point);
+    this->max = glm::max(this->max, point);
+}
+
+void BVH::Bounds::grow(const Bounds &bounds) {
+    this->min = glm::min(this->min, bounds.min);
+    this->max = glm::max(this->max, bounds.max);
+}
+
+/// @brief Surface area of the box, used as the probability of a ray hitting it
+float BVH::Bounds::area() const {
+    if (this->min.x > this->max.x) return 0.f; // empty
+    glm::vec3 extent = this->max - this->min;
+    return extent.x * extent.y + extent.y * extent.z + extent.z * extent.x;
+}
+
+BVH::BVH() = default;
+
+/// @brief Builds the hierarchy top-down, splitting each node with the binned surface area heuristic
+BVH::BVH(const Geometry &geometry) {
+    uint32_t triangleCount = geometry.size();
+    if (triangleCount == 0) return;
+    this->triangleBounds.resize(triangleCount);
+    this->centroids.resize(triangleCount);
+    this->indices.resize(triangleCount);
+    for (uint32_t i=0; i<triangleCount; i++) {
+        for (int corner=0; corner<3; corner++) this->triangleBounds[i].grow(geometry.vertex(i, corner));
+        this->centroids[i] = (this->triangleBounds[i].min + this->triangleBounds[i].max) * 0.5f;
+        this->indices[i] = i;
+    }
+    this->nodes.reserve(2 * triangleCount);
+    this->nodes.push_back({});
+    this->subdivide(0, 0, triangleCount, 0);
+    this->nodes.shrink_to_fit();
+    this->triangles.reserve(triangleCount);
+    for (uint32_t index : this->indices) {
+        glm::vec3 v0 = geometry.vertex(index, 0);
+        this->triangles.push_back({v0, geometry.vertex(index, 1) - v0, geometry.vertex(index, 2) - v0, index});
+    }
+    // only needed while building
+    this->triangleBounds = std::vector<Bounds>();
+    this->centroids = std::vector<glm::vec3>();
+    this->indices = std::vector<uint32_t>();
+}
+
+/// @brief Fits the node around its triangles, then splits it in two if that is cheaper than leaving it as a leaf
+void BVH::subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth) {
+    Bounds bounds;
+    Bounds centroidBounds;
+    for (uint32_t i=first; i<first+count; i++) {
+        bounds.grow(this->triangleBounds[this->indices[i]]);
+        centroidBounds.grow(this->centroids[this->indices[i]]);
+    }
+    Node &node = this->nodes[nodeIndex];
+    node.min = bounds.min;
+    node.max = bounds.max;
+    node.leftFirst = first;
+    node.count = count;
+    if (count <= 2 || depth >= maxDepth) return;
+
+    // find the cheapest split plane between bins along any axis
+    float leafCost = (float) count;
+    float bestCost = FLT_MAX;
+    int bestAxis = -1;
+    int bestSplit = 0;
+    for (int axis=0; axis<3; axis++) {
+        float axisMin = centroidBounds.min[axis];
+        float axisExtent = centroidBounds.max[axis] - axisMin;
+        if (axisExtent <= 0.f) continue; // all centroids lie on one plane
+        Bounds binBounds[binCount];
+        uint32_t binTriangles[binCount] = {};
+        float scale = binCount / axisExtent;
+        for (uint32_t i=first; i<first+count; i++) {
+            uint32_t triangle = this->indices[i];
+            int bin = std::min(binCount - 1, (int) ((this->centroids[triangle][axis] - axisMin) * scale));
+            binBounds[bin].grow(this->triangleBounds[triangle]);
+            binTriangles[bin]++;
+        }
+        // sweep from the right to get the cost of everything above each plane, then from the left
+        float rightAreas[binCount];
+        uint32_t rightCounts[binCount];
+        Bounds right;
+        uint32_t rightCount = 0;
+        for (int bin=binCount-1; bin>0; bin--) {
+            right.grow(binBounds[bin]);
+            rightCount += binTriangles[bin];
+            rightAreas[bin] = right.area();
+            rightCounts[bin] = rightCount;
+        }
+        Bounds left;
+        uint32_t leftCount = 0;
+        for (int split=1; split<binCount; split++) {
+            left.grow(binBounds[split - 1]);
+            leftCount += binTriangles[split - 1];
+            if (leftCount == 0 || rightCounts[split] == 0) continue;
+            float cost = left.area() * leftCount + rightAreas[split] * rightCounts[split];
+            if (cost < bestCost) {
+                bestCost = cost;
+                bestAxis = axis;
+                bestSplit = split;
+            }
+        }
+    }
+    if (bestAxis == -1) return; // triangles cannot be separated
+    bestCost = traversalCost + bestCost / bounds.area();
+    if (bestCost >= leafCost && count <= maxLeafSize) return;
+
+    float axisMin = centroidBounds.min[bestAxis];
+    float scale = binCount / (centroidBounds.max[bestAxis] - axisMin);
+    uint32_t *middle = std::partition(&this->indices[first], &this->indices[first] + count, [&](uint32_t triangle) {
+        return std::min(binCount - 1, (int) ((this->centroids[triangle][bestAxis] - axisMin) * scale)) < bestSplit;
+    });
+    uint32_t leftCount = middle - &this->indices[first];
+    uint32_t leftChild = this->nodes.size();
+    this->nodes.push_back({});
+    this->nodes.push_back({});
+    this->nodes[nodeIndex].leftFirst = leftChild;
+    this->nodes[nodeIndex].count = 0;
+    this->subdivide(leftChild, first, leftCount, depth + 1);
+    this->subdivide(leftChild + 1, first + leftCount, count - leftCount, depth + 1);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include "Geometry.h"
+
+class BVH {
+private:
+    struct Bounds {
+        glm::vec3 min;
+        glm::vec3 max;
+        Bounds();
+        void grow(glm::vec3 point);
+        void grow(const Bounds &bounds);
+        float area() const;
+    };
+    std::vector<Bounds> triangleBounds;
+    std::vector<glm::vec3> centroids;
+    std::vector<uint32_t> indices;
+    void subdivide(uint32_t nodeIndex, uint32_t first, uint32_t count, int depth);
+public:
+    struct Node {
+        glm::vec3 min;
+        uint32_t leftFirst; // first entry in triangles if leaf, otherwise index of left child (right child follows it)
+        glm::vec3 max;
+        uint32_t count; // number of triangles if leaf, 0 otherwise
+    };
+    struct Triangle {
+        glm::vec3 v0;
+        glm::vec3 e0; // v1 - v0
+        glm::vec3 e1; // v2 - v0
+        uint32_t index; // position in the scene's triangle list
+    };
+    static const int maxDepth = 60;
+    std::vector<Node> nodes;
+    std::vector<Triangle> triangles; // precomputed intersection data, ordered so every leaf covers a contiguous range
+    BVH();
+    explicit BVH(const Geometry &geometry);
+};
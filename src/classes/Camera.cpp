@@ -1,5 +1,8 @@
 #include "Camera.h"
 #include <CanvasPoint.h>
+#ifdef __AVX__
+#include <immintrin.h>
+#endif
 
 
 Camera::Camera(float _width, float _height, glm::vec3 _position, bool _orbit): width(_width), height(_height), position(_position), orbit(_orbit) {
@@ -7,11 +10,6 @@ Camera::Camera(float _width, float _height, glm::vec3 _position, bool _orbit): w
     this->lookAt({0.0, 0.0, 0.0});
 }
 
-/// @brief Sets all the values in the depth buffer to zero
-void Camera::resetDepthBuffer() {
-    this->depthBuffer = std::vector<std::vector<float>>(this->height, std::vector<float>(this->width, 0.f));
-}
-
 /// @brief Translates camera position
 void Camera::translate(Axis axis, float sign) {
     float delta = 0.03f * sign;
@@ -65,11 +63,80 @@ void Camera::rotate(Axis axis, float sign) {
     this->updateVP();
 }
 
+/// @brief Where the camera is and which way it faces, as its camera to world matrix
+glm::mat4 Camera::pose() const {
+    return this->camera;
+}
+
+/// @brief Moves the camera to a pose taken from this or another camera of the same size
+void Camera::setPose(const glm::mat4 &pose) {
+    this->camera = pose;
+    this->updateVP();
+}
+
 /// @brief Updates the view-projection matrix after a change to the camera matrix
 void Camera::updateVP() {
     glm::mat4 view = glm::inverse(this->camera);
     this->position = glm::vec3(this->camera[3]); // get first 3 coords from 4th column
     this->vp = this->projection * view;
+    this->inverseVP = glm::inverse(this->vp);
+    this->updateRayBasis();
+}
+
+/// @brief Caches where the ray through pixel (0, 0) starts and points, and how both change per pixel.
+/// Rays start on the near plane and head for the matching point on the far plane
+void Camera::updateRayBasis() {
+    float n = this->near;
+    float f = this->far;
+    glm::vec2 pixelStep(2.f / this->width, 2.f / this->height); // pixel coords to [-1, 1]
+    glm::vec4 nearPos(-1.f, -1.f, -1.f, 1.f); // pixel (0, 0) on near plane
+    glm::vec4 farPos(-(f - n), -(f - n), f + n, f - n); // pixel (0, 0) on far plane
+    this->rayBasis.origin = glm::vec3(this->inverseVP * nearPos * n);
+    this->rayBasis.originStepX = glm::vec3(this->inverseVP[0]) * n * pixelStep.x;
+    this->rayBasis.originStepY = glm::vec3(this->inverseVP[1]) * n * pixelStep.y;
+    this->rayBasis.direction = glm::vec3(this->inverseVP * farPos);
+    this->rayBasis.directionStepX = glm::vec3(this->inverseVP[0]) * (f - n) * pixelStep.x;
+    this->rayBasis.directionStepY = glm::vec3(this->inverseVP[1]) * (f - n) * pixelStep.y;
+}
+
+/// @brief Gets the ray from the camera's near plane through a canvas point
+Ray Camera::generateRay(float x, float y) const {
+    const RayBasis &basis = this->rayBasis;
+    glm::vec3 origin = basis.origin + x * basis.originStepX + y * basis.originStepY;
+    glm::vec3 direction = basis.direction + x * basis.directionStepX + y * basis.directionStepY;
+    return {origin, glm::normalize(direction)};
+}
+
+/// @brief Gets the rays through rayBatchSize neighbouring pixels on row y, starting at column x
+void Camera::generateRays(int x, int y, RayBatch &batch) const {
+    const RayBasis &basis = this->rayBasis;
+    float *origins[3] = {batch.originX, batch.originY, batch.originZ};
+    float *directions[3] = {batch.directionX, batch.directionY, batch.directionZ};
+#ifdef __AVX__
+    __m256 pixelX = _mm256_add_ps(_mm256_set1_ps((float) x), _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f));
+    __m256 pixelY = _mm256_set1_ps((float) y);
+    __m256 direction[3];
+    for (int i=0; i<3; i++) {
+        __m256 origin = _mm256_add_ps(_mm256_set1_ps(basis.origin[i] + y * basis.originStepY[i]), _mm256_mul_ps(pixelX, _mm256_set1_ps(basis.originStepX[i])));
+        _mm256_store_ps(origins[i], origin);
+        direction[i] = _mm256_add_ps(_mm256_add_ps(_mm256_set1_ps(basis.direction[i]), _mm256_mul_ps(pixelY, _mm256_set1_ps(basis.directionStepY[i]))), _mm256_mul_ps(pixelX, _mm256_set1_ps(basis.directionStepX[i])));
+    }
+    __m256 lengthSquared = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(direction[0], direction[0]), _mm256_mul_ps(direction[1], direction[1])), _mm256_mul_ps(direction[2], direction[2]));
+    __m256 length = _mm256_sqrt_ps(lengthSquared);
+    for (int i=0; i<3; i++) _mm256_store_ps(directions[i], _mm256_div_ps(direction[i], length));
+#else
+    for (int lane=0; lane<rayBatchSize; lane++) {
+        Ray ray = this->generateRay((float) (x + lane), (float) y);
+        for (int i=0; i<3; i++) {
+            origins[i][lane] = ray.origin[i];
+            directions[i][lane] = ray.direction[i];
+        }
+    }
+#endif
+}
+
+Ray Camera::RayBatch::ray(int i) const {
+    return {{this->originX[i], this->originY[i], this->originZ[i]}, {this->directionX[i], this->directionY[i], this->directionZ[i]}};
 }
 
 /// @brief Alters the camera orientation to face a given vertex
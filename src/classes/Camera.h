@@ -4,6 +4,7 @@
 #include <vector>
 #include <cmath>
 #include <glm/gtc/matrix_transform.hpp>
+#include <Ray.h>
 
 class Camera {
 private:
@@ -12,18 +13,43 @@ private:
     glm::mat4 camera;
     glm::mat4 projection;
     void updateVP();
+    void updateRayBasis();
 public:
     enum Axis { x, y, z };
+    static constexpr int rayBatchSize = 8;
+    /// @brief Primary rays for a run of pixels along a row, stored as separate components for SIMD
+    struct RayBatch {
+        alignas(32) float originX[rayBatchSize];
+        alignas(32) float originY[rayBatchSize];
+        alignas(32) float originZ[rayBatchSize];
+        alignas(32) float directionX[rayBatchSize];
+        alignas(32) float directionY[rayBatchSize];
+        alignas(32) float directionZ[rayBatchSize];
+        Ray ray(int i) const;
+    };
+    /// @brief Primary ray origins and (unnormalised) directions are affine in pixel coords, so are stored at pixel (0, 0) plus a step per pixel
+    struct RayBasis {
+        glm::vec3 origin;
+        glm::vec3 originStepX;
+        glm::vec3 originStepY;
+        glm::vec3 direction;
+        glm::vec3 directionStepX;
+        glm::vec3 directionStepY;
+    };
     glm::mat4 vp;
+    glm::mat4 inverseVP;
+    RayBasis rayBasis;
     const glm::mat4 model = glm::translate(glm::mat4(0.35f), {0.f, 0.f, 0.f}); // place object at origin, scaled to 0.35x
     glm::vec3 position;
     const float near = 0.1f;
     const float far = 100.f;
     bool orbit;
-    std::vector<std::vector<float>> depthBuffer;
     Camera(float width, float height, glm::vec3 position, bool orbit);
-    void resetDepthBuffer();
     void translate(Axis axis, float sign);
     void rotate(Axis axis, float sign);
     void lookAt(glm::vec3 vertex);
+    glm::mat4 pose() const;
+    void setPose(const glm::mat4 &pose);
+    Ray generateRay(float x, float y) const;
+    void generateRays(int x, int y, RayBatch &batch) const;
 };
@@ -0,0 +1,193 @@
+#include "Geometry.h"
+#include "ThreadPool.h"
+#include <algorithm>
+#include <cfloat>
+#include <cstring>
+
+namespace {
+    /// @brief Bit pattern of a vertex's attributes, vertices are only welded when these all match exactly
+    struct VertexKey {
+        uint32_t bits[8];
+        VertexKey(glm::vec3 position, glm::vec3 normal, glm::vec2 textureCoordinate) {
+            std::memcpy(this->bits, &position[0], 3 * sizeof(uint32_t));
+            std::memcpy(this->bits + 3, &normal[0], 3 * sizeof(uint32_t));
+            std::memcpy(this->bits + 6, &textureCoordinate[0], 2 * sizeof(uint32_t));
+            for (uint32_t &word : this->bits) {
+                if (word == 0x80000000u) word = 0; // -0 == 0
+            }
+        }
+        bool operator==(const VertexKey &other) const {
+            return std::memcmp(this->bits, other.bits, sizeof(this->bits)) == 0;
+        }
+    };
+
+    struct VertexHash {
+        size_t operator()(const VertexKey &key) const {
+            uint64_t hash = 14695981039346656037ull; // FNV-1a over the words
+            for (uint32_t word : key.bits) {
+                hash ^= word;
+                hash *= 1099511628211ull;
+            }
+            return (size_t) (hash ^ (hash >> 32));
+        }
+    };
+
+    /// @brief Gives each of count vertices the index of the distinct key it has, in order of first appearance, and lists the first vertex with each key
+    template <typename KeyOf>
+    void weld(size_t count, KeyOf keyOf, std::vector<uint32_t> &remap, std::vector<uint32_t> &firstVertices) {
+        // open addressing table of indices into uniqueKeys, sized to stay at most half full
+        size_t capacity = 16;
+        while (capacity < 2 * count) capacity *= 2;
+        const uint32_t empty = UINT32_MAX;
+        std::vector<uint32_t> slots(capacity, empty);
+        std::vector<VertexKey> uniqueKeys;
+        VertexHash hash;
+        remap.resize(count);
+        firstVertices.clear();
+        for (size_t i=0; i<count; i++) {
+            VertexKey key = keyOf(i);
+            size_t slot = hash(key) & (capacity - 1);
+            while (slots[slot] != empty && !(uniqueKeys[slots[slot]] == key)) slot = (slot + 1) & (capacity - 1);
+            if (slots[slot] == empty) {
+                slots[slot] = (uint32_t) uniqueKeys.size();
+                uniqueKeys.push_back(key);
+                firstVertices.push_back((uint32_t) i);
+            }
+            remap[i] = slots[slot];
+        }
+    }
+}
+
+void Geometry::VectorStream::resize(size_t size) {
+    this->x.resize(size);
+    this->y.resize(size);
+    this->z.resize(size);
+}
+
+Geometry::Geometry() = default;
+
+/// @brief Welds vertices with the same position (and normal and texture coordinate, if given) into one, then points the triangles at the welded vertices.
+/// normals and textureCoordinates are either empty or hold one entry per vertex, a zero normal is filled in by calculateNormals
+Geometry::Geometry(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals, const std::vector<glm::vec2> &textureCoordinates, const std::vector<uint32_t> &indices, const std::vector<uint16_t> &materialIds): suppliedNormals(!normals.empty()) {
+    std::vector<uint32_t> remap;
+    std::vector<uint32_t> uniqueVertices; // first vertex seen with each key
+    weld(vertices.size(), [&](size_t i) {
+        return VertexKey(vertices[i], normals.empty() ? glm::vec3(0.f) : normals[i], textureCoordinates.empty() ? glm::vec2(0.f) : textureCoordinates[i]);
+    }, remap, uniqueVertices);
+    size_t uniqueCount = uniqueVertices.size();
+    this->positions.resize(uniqueCount);
+    this->vertexNormals.resize(uniqueCount);
+    this->textureU.resize(uniqueCount);
+    this->textureV.resize(uniqueCount);
+    for (size_t i=0; i<uniqueCount; i++) {
+        uint32_t vertex = uniqueVertices[i];
+        this->positions.set(i, vertices[vertex]);
+        if (!normals.empty()) this->vertexNormals.set(i, normals[vertex]);
+        if (!textureCoordinates.empty()) {
+            this->textureU[i] = textureCoordinates[vertex].x;
+            this->textureV[i] = textureCoordinates[vertex].y;
+        }
+    }
+    this->indices.resize(indices.size());
+    for (size_t i=0; i<indices.size(); i++) this->indices[i] = remap[indices[i]];
+    this->surfaceNormals.resize(materialIds.size());
+    this->materialIds.assign(materialIds.begin(), materialIds.end());
+}
+
+/// @brief Flattens standalone triangles into a vertex and index list before welding
+Geometry::Geometry(const std::vector<ModelTriangle> &triangles) {
+    std::vector<glm::vec3> vertices;
+    std::vector<glm::vec2> textureCoordinates;
+    std::vector<uint32_t> indices;
+    std::vector<uint16_t> materialIds;
+    vertices.reserve(3 * triangles.size());
+    textureCoordinates.reserve(3 * triangles.size());
+    indices.reserve(3 * triangles.size());
+    materialIds.reserve(triangles.size());
+    for (const auto &triangle : triangles) {
+        for (int corner=0; corner<3; corner++) {
+            indices.push_back((uint32_t) vertices.size());
+            vertices.push_back(triangle.vertices[corner]);
+            textureCoordinates.emplace_back(triangle.texturePoints[corner].x, triangle.texturePoints[corner].y);
+        }
+        materialIds.push_back(triangle.materialId);
+    }
+    *this = Geometry(vertices, {}, textureCoordinates, indices, materialIds);
+}
+
+/// @brief Finds the face normal of every triangle, then gives each vertex without a normal the sum of the (area weighted) face normals around its position.
+/// Summing by position rather than by vertex keeps copies of a vertex split at a texture seam smooth across it
+void Geometry::calculateNormals(ThreadPool &threadPool) {
+    size_t triangleCount = this->size();
+    size_t vertexCount = this->vertexCount();
+    const size_t blockSize = 4096;
+    threadPool.parallelFor((triangleCount + blockSize - 1) / blockSize, [&](size_t block) {
+        size_t end = std::min(triangleCount, (block + 1) * blockSize);
+        for (size_t i=block*blockSize; i<end; i++) {
+            glm::vec3 v0 = this->vertex(i, 0);
+            this->surfaceNormals.set(i, glm::cross(this->vertex(i, 1) - v0, this->vertex(i, 2) - v0));
+        }
+    });
+    std::vector<uint32_t> positionIds; // vertices at the same position share one
+    std::vector<uint32_t> firstVertices;
+    weld(vertexCount, [&](size_t i) { return VertexKey(this->positions.get(i), glm::vec3(0.f), glm::vec2(0.f)); }, positionIds, firstVertices);
+    size_t positionCount = firstVertices.size();
+    // list the triangles around each position (counting sort by position), so each position can gather its sum without sharing writes
+    std::vector<uint32_t> firstAdjacent(positionCount + 1, 0);
+    for (uint32_t index : this->indices) firstAdjacent[positionIds[index] + 1]++;
+    for (size_t i=0; i<positionCount; i++) firstAdjacent[i + 1] += firstAdjacent[i];
+    std::vector<uint32_t> adjacent(this->indices.size());
+    std::vector<uint32_t> filled(firstAdjacent.begin(), firstAdjacent.end() - 1);
+    for (size_t i=0; i<this->indices.size(); i++) adjacent[filled[positionIds[this->indices[i]]]++] = (uint32_t) (i / 3);
+    std::vector<glm::vec3> positionNormals(positionCount);
+    threadPool.parallelFor((positionCount + blockSize - 1) / blockSize, [&](size_t block) {
+        size_t end = std::min(positionCount, (block + 1) * blockSize);
+        for (size_t i=block*blockSize; i<end; i++) {
+            glm::vec3 positionNormal(0.f);
+            for (uint32_t j=firstAdjacent[i]; j<firstAdjacent[i + 1]; j++) positionNormal += this->surfaceNormals.get(adjacent[j]);
+            positionNormals[i] = positionNormal;
+        }
+    });
+    threadPool.parallelFor((vertexCount + blockSize - 1) / blockSize, [&](size_t block) {
+        size_t end = std::min(vertexCount, (block + 1) * blockSize);
+        for (size_t i=block*blockSize; i<end; i++) {
+            if (this->suppliedNormals && this->vertexNormals.get(i) != glm::vec3(0.f)) continue;
+            this->vertexNormals.set(i, positionNormals[positionIds[i]]);
+        }
+    });
+}
+
+/// @brief Splits the triangles into objects wherever the material changes, and fits a box around each
+void Geometry::calculateBounds() {
+    this->objects.clear();
+    uint32_t triangleCount = (uint32_t) this->size();
+    for (uint32_t i=0; i<triangleCount; i++) {
+        if (this->objects.empty() || this->objects.back().count == maxObjectSize || this->materialIds[i] != this->materialIds[i - 1]) {
+            this->objects.push_back({i, 0, glm::vec3(FLT_MAX), glm::vec3(-FLT_MAX)});
+        }
+        Object &object = this->objects.back();
+        object.count++;
+        for (int corner=0; corner<3; corner++) {
+            glm::vec3 vertex = this->vertex(i, corner);
+            object.min = glm::min(object.min, vertex);
+            object.max = glm::max(object.max, vertex);
+        }
+    }
+}
+
+size_t Geometry::size() const {
+    return this->materialIds.size();
+}
+
+size_t Geometry::vertexCount() const {
+    return this->positions.size();
+}
+
+/// @brief Memory held by all the streams, divided by the number of triangles
+size_t Geometry::bytesPerTriangle() const {
+    if (this->size() == 0) return 0;
+    size_t floats = 3 * (this->positions.x.capacity() + this->vertexNormals.x.capacity() + this->surfaceNormals.x.capacity());
+    floats += this->textureU.capacity() + this->textureV.capacity();
+    size_t bytes = floats * sizeof(float) + this->indices.capacity() * sizeof(uint32_t) + this->materialIds.capacity() * sizeof(uint16_t);
+    return bytes / this->size();
+}
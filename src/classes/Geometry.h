@@ -0,0 +1,65 @@
+#pragma once
+
+#include <glm/glm.hpp>
+#include <vector>
+#include <cstdint>
+#include <ModelTriangle.h>
+#include "MemoryUtils.h"
+
+class ThreadPool;
+
+/// @brief Indexed triangle mesh split into one stream per attribute, so a pass only pulls the attributes it reads through the cache
+class Geometry {
+public:
+    template <typename T>
+    using Stream = std::vector<T, MemoryUtils::AlignedAllocator<T>>;
+    /// @brief A stream of 3D vectors with each component in its own array
+    struct VectorStream {
+        Stream<float> x;
+        Stream<float> y;
+        Stream<float> z;
+        void resize(size_t size);
+        size_t size() const {
+            return this->x.size();
+        }
+        glm::vec3 get(size_t i) const {
+            return {this->x[i], this->y[i], this->z[i]};
+        }
+        void set(size_t i, glm::vec3 value) {
+            this->x[i] = value.x;
+            this->y[i] = value.y;
+            this->z[i] = value.z;
+        }
+    };
+    /// @brief A run of triangles sharing a material (a usemtl group of the model, cut into pieces of at most maxObjectSize) and the box around them
+    struct Object {
+        uint32_t first; // triangle
+        uint32_t count;
+        glm::vec3 min;
+        glm::vec3 max;
+    };
+    static const uint32_t maxObjectSize = 1024; // triangles, so one large mesh is still culled a piece at a time
+    VectorStream positions; // one per unique vertex
+    VectorStream vertexNormals; // same layout as positions
+    Stream<float> textureU; // same layout as positions
+    Stream<float> textureV;
+    Stream<uint32_t> indices; // three per triangle, corner c of triangle i is at 3 * i + c
+    VectorStream surfaceNormals; // one per triangle
+    Stream<uint16_t> materialIds; // one per triangle, indexes the scene's material table
+    std::vector<Object> objects; // in triangle order, covering every triangle once, filled by calculateBounds
+    bool suppliedNormals = false; // vertex normals came from the model file rather than calculateNormals
+    Geometry();
+    Geometry(const std::vector<glm::vec3> &vertices, const std::vector<glm::vec3> &normals, const std::vector<glm::vec2> &textureCoordinates, const std::vector<uint32_t> &indices, const std::vector<uint16_t> &materialIds);
+    explicit Geometry(const std::vector<ModelTriangle> &triangles);
+    void calculateNormals(ThreadPool &threadPool);
+    void calculateBounds();
+    size_t size() const;
+    size_t vertexCount() const;
+    size_t bytesPerTriangle() const;
+    glm::vec3 vertex(size_t triangle, int corner) const {
+        return this->positions.get(this->indices[3 * triangle + corner]);
+    }
+    glm::vec3 vertexNormal(size_t triangle, int corner) const {
+        return this->vertexNormals.get(this->indices[3 * triangle + corner]);
+    }
+};
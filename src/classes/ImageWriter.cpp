@@ -0,0 +1,72 @@
+#include "ImageWriter.h"
+#include "FilesUtils.h"
+
+/// @brief Starts the writer thread, which calls onWritten after each frame, starting at firstFrame. At most queueLength frames wait to be written
+ImageWriter::ImageWriter(size_t firstFrame, size_t _queueLength, ImageUtils::Format _format, int encoderThreadCount, std::function<void(size_t frame, bool saved)> _onWritten):
+        onWritten(std::move(_onWritten)),
+        format(_format),
+        encoderThreads(_format == ImageUtils::PNG ? encoderThreadCount : 1),
+        nextFrame(firstFrame),
+        queueLength(_queueLength < 1 ? 1 : _queueLength),
+        stopping(false)
+        {
+    this->writer = std::thread(&ImageWriter::writerLoop, this);
+}
+
+ImageWriter::~ImageWriter() {
+    this->finish();
+}
+
+/// @brief Hands a drawn frame over to be written. Blocks while the frame is queueLength or more ahead of the one being written,
+/// which keeps the frame that is due from ever waiting behind later ones
+void ImageWriter::save(size_t frame, RenderTarget target, std::string name) {
+    {
+        std::unique_lock<std::mutex> lock(this->mutex);
+        this->frameWritten.wait(lock, [&]() { return frame < this->nextFrame + this->queueLength; });
+        this->queued.emplace(frame, Frame{std::move(target), std::move(name)});
+    }
+    this->frameQueued.notify_one();
+}
+
+/// @brief A target whose frame has been written, to draw the next one in without allocating, or a new one if there are none yet
+RenderTarget ImageWriter::takeSpare(int width, int height) {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        if (!this->spare.empty()) {
+            RenderTarget target = std::move(this->spare.back());
+            this->spare.pop_back();
+            return target;
+        }
+    }
+    return RenderTarget(width, height);
+}
+
+/// @brief Writes everything queued, then stops the writer thread
+void ImageWriter::finish() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->frameQueued.notify_one();
+    if (this->writer.joinable()) this->writer.join();
+}
+
+void ImageWriter::writerLoop() {
+    std::unique_lock<std::mutex> lock(this->mutex);
+    while (true) {
+        this->frameQueued.wait(lock, [&]() { return this->queued.count(this->nextFrame) != 0 || this->stopping; });
+        if (this->queued.empty()) return;
+        // the frame that is due, unless finishing without it, when the rest are written anyway
+        auto next = this->queued.begin();
+        size_t frame = next->first;
+        Frame job = std::move(next->second);
+        this->queued.erase(next);
+        lock.unlock();
+        bool saved = FilesUtils::saveAsImage(job.target, job.name, this->format, this->encoderThreads);
+        if (this->onWritten) this->onWritten(frame, saved);
+        lock.lock();
+        this->spare.push_back(std::move(job.target));
+        this->nextFrame = frame + 1;
+        this->frameWritten.notify_all();
+    }
+}
@@ -0,0 +1,42 @@
+#pragma once
+
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <RenderTarget.h>
+#include "ImageUtils.h"
+#include "ThreadPool.h"
+
+/// @brief Saves numbered frames to output/ in order, in one format, on a thread of its own, so drawing only waits for the disk once it is too far behind
+class ImageWriter {
+private:
+    struct Frame {
+        RenderTarget target;
+        std::string name;
+    };
+    std::map<size_t, Frame> queued; // by frame number, waiting to be written
+    std::vector<RenderTarget> spare; // already written, so can be drawn over
+    std::function<void(size_t frame, bool saved)> onWritten;
+    ImageUtils::Format format;
+    ThreadPool encoderThreads; // share out encoding a frame, where the format allows it
+    size_t nextFrame; // frames after it wait for it to be written first
+    size_t queueLength;
+    bool stopping;
+    std::mutex mutex;
+    std::condition_variable frameQueued;
+    std::condition_variable frameWritten;
+    std::thread writer;
+    void writerLoop();
+public:
+    ImageWriter(size_t firstFrame, size_t queueLength, ImageUtils::Format format, int encoderThreadCount, std::function<void(size_t frame, bool saved)> onWritten);
+    ~ImageWriter();
+    ImageWriter(const ImageWriter &) = delete;
+    ImageWriter &operator=(const ImageWriter &) = delete;
+    void save(size_t frame, RenderTarget target, std::string name);
+    RenderTarget takeSpare(int width, int height);
+    void finish();
+};
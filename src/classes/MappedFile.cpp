@@ -0,0 +1,60 @@
+#include "MappedFile.h"
+#ifdef _WIN32
+#include <fstream>
+#include <iterator>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#ifdef _WIN32
+MappedFile::MappedFile(const std::string &path): bytes(nullptr), length(0), open(false) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return;
+    this->buffer.assign(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    this->bytes = this->buffer.data();
+    this->length = this->buffer.size();
+    this->open = true;
+}
+
+MappedFile::~MappedFile() = default;
+#else
+MappedFile::MappedFile(const std::string &path): bytes(nullptr), length(0), open(false) {
+    int descriptor = ::open(path.c_str(), O_RDONLY);
+    if (descriptor == -1) return;
+    struct stat status;
+    if (fstat(descriptor, &status) == 0) {
+        this->open = true;
+        this->length = (size_t) status.st_size;
+        if (this->length > 0) {
+            void *mapping = mmap(nullptr, this->length, PROT_READ, MAP_PRIVATE, descriptor, 0);
+            if (mapping == MAP_FAILED) {
+                this->open = false;
+                this->length = 0;
+            } else {
+                madvise(mapping, this->length, MADV_WILLNEED);
+                this->bytes = static_cast<const char *>(mapping);
+            }
+        }
+    }
+    close(descriptor); // the mapping stays valid after the descriptor is closed
+}
+
+MappedFile::~MappedFile() {
+    if (this->bytes != nullptr) munmap(const_cast<char *>(this->bytes), this->length);
+}
+#endif
+
+bool MappedFile::isOpen() const {
+    return this->open;
+}
+
+const char *MappedFile::data() const {
+    return this->bytes;
+}
+
+size_t MappedFile::size() const {
+    return this->length;
+}
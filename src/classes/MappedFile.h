@@ -0,0 +1,21 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+/// @brief Read-only view of a whole file, memory mapped where the platform allows it
+class MappedFile {
+private:
+    const char *bytes;
+    size_t length;
+    bool open;
+    std::vector<char> buffer; // holds the file contents on platforms without mmap
+public:
+    explicit MappedFile(const std::string &path);
+    ~MappedFile();
+    MappedFile(const MappedFile &) = delete;
+    MappedFile &operator=(const MappedFile &) = delete;
+    bool isOpen() const;
+    const char *data() const;
+    size_t size() const;
+};
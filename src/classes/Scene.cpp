@@ -1,44 +1,65 @@
 #include "Scene.h"
 #include "RayTracingUtils.h"
 #include "RasterisingUtils.h"
-#include "TriangleUtils.h"
+#include "MemoryUtils.h"
+#include <chrono>
 
-Scene::Scene(float _width, float _height, bool _show, bool _mirror, RenderMode _renderMode, Light _light, std::vector<ModelTriangle> _triangles, Camera _camera):
+Scene::Scene(float _width, float _height, bool _show, bool _mirror, RenderMode _renderMode, Light _light, Geometry _geometry, std::vector<Material> _materials, Camera _camera):
         width(_width),
         height(_height),
         show(_show),
         mirror(_mirror),
         renderMode(_renderMode),
         light(_light),
-        triangles(std::move(_triangles)),
+        materials(std::move(_materials)),
         camera(std::move(_camera))
         {
-    this->window = DrawingWindow((int) width, (int) height, false, show);
-    this->modelToWorld();
-    this->calculateNormals();
+    this->target = RenderTarget((int) width, (int) height);
+    this->setThreadCount(ThreadPool::defaultThreadCount());
+    this->modelToWorld(_geometry);
+    _geometry.calculateNormals(*this->threadPool);
+    _geometry.calculateBounds();
+    this->bvh = std::make_shared<const BVH>(_geometry);
+    this->geometry = std::make_shared<const Geometry>(std::move(_geometry));
 }
 
-/// @brief Converts the loaded model coordinates to world coordinates
-void Scene::modelToWorld() {
-    for (auto &triangle : this->triangles) {
-        for (auto &vertex : triangle.vertices) {
-            glm::vec4 temp(vertex, 1.f);
-            vertex = glm::vec3(this->camera.model * temp);
-        }
-    }
+/// @brief Scene around geometry that is already in world space with its normals, object bounds and BVH built, as read back from a scene cache
+Scene::Scene(float _width, float _height, bool _show, bool _mirror, RenderMode _renderMode, Light _light, Geometry _geometry, std::vector<Material> _materials, BVH _bvh, Camera _camera):
+        width(_width),
+        height(_height),
+        show(_show),
+        mirror(_mirror),
+        renderMode(_renderMode),
+        light(_light),
+        geometry(std::make_shared<const Geometry>(std::move(_geometry))),
+        materials(std::move(_materials)),
+        bvh(std::make_shared<const BVH>(std::move(_bvh))),
+        camera(std::move(_camera))
+        {
+    this->target = RenderTarget((int) width, (int) height);
+    this->setThreadCount(ThreadPool::defaultThreadCount());
 }
 
-void Scene::calculateNormals() {
-    for (auto &triangle : this->triangles) {
-        triangle.surfaceNormal = TriangleUtils::calculateSurfaceNormal(triangle.vertices);
+/// @brief Converts the loaded model coordinates to world coordinates
+void Scene::modelToWorld(Geometry &geometry) const {
+    for (size_t i=0; i<geometry.vertexCount(); i++) {
+        glm::vec4 temp(geometry.positions.get(i), 1.f);
+        geometry.positions.set(i, glm::vec3(this->camera.model * temp));
     }
-    for (auto &triangle : this->triangles) {
-        triangle.vertexNormals[0] = TriangleUtils::calculateVertexNormals(triangle, this->triangles, triangle.vertices[0]);
-        triangle.vertexNormals[1] = TriangleUtils::calculateVertexNormals(triangle, this->triangles, triangle.vertices[1]);
-        triangle.vertexNormals[2] = TriangleUtils::calculateVertexNormals(triangle, this->triangles, triangle.vertices[2]);
+    if (!geometry.suppliedNormals) return;
+    // normals go through the inverse transpose so they stay perpendicular under non-uniform scaling
+    glm::mat3 normalMatrix = glm::inverse(glm::transpose(glm::mat3(this->camera.model)));
+    for (size_t i=0; i<geometry.vertexCount(); i++) {
+        glm::vec3 normal = geometry.vertexNormals.get(i);
+        if (normal != glm::vec3(0.f)) geometry.vertexNormals.set(i, glm::normalize(normalMatrix * normal));
     }
 }
 
+/// @brief Sets how many threads share out the work of drawing a frame, 1 renders serially
+void Scene::setThreadCount(int threadCount) {
+    this->threadPool = std::make_shared<ThreadPool>(threadCount);
+}
+
 /// @brief Moves the light around in the scene
 void Scene::moveLight(Camera::Axis axis, float sign) {
     float delta = 0.1f * sign;
@@ -58,7 +79,11 @@ void Scene::moveLight(Camera::Axis axis, float sign) {
 }
 
 void Scene::draw() {
-    this->window.clearPixels();
+    auto start = std::chrono::steady_clock::now();
+    size_t allocations = MemoryUtils::allocationCount();
+    this->target.clearPixels();
+    this->stats.culledTriangles = 0;
+    this->stats.skippedPixelTests = 0;
     switch(this->renderMode) {
         case WIRE_FRAME:
             RasterisingUtils::drawStroked(*this);
@@ -72,4 +97,6 @@ void Scene::draw() {
         default:
             break;
     }
+    this->stats.milliseconds = std::chrono::duration<float, std::milli>(std::chrono::steady_clock::now() - start).count();
+    this->stats.allocations = MemoryUtils::allocationCount() - allocations;
 }
\ No newline at end of file
@@ -2,15 +2,26 @@
 
 #include <glm/glm.hpp>
 #include "Camera.h"
-#include <DrawingWindow.h>
+#include "BVH.h"
+#include "Geometry.h"
+#include "ThreadPool.h"
+#include "RasterisingUtils.h"
+#include <RenderTarget.h>
 #include <ModelTriangle.h>
+#include <Material.h>
 #include <Light.h>
+#include <memory>
 
 class Scene {
 private:
-    void modelToWorld();
-    void calculateNormals();
+    void modelToWorld(Geometry &geometry) const;
 public:
+    struct FrameStats {
+        float milliseconds = 0.f;
+        size_t allocations = 0; // heap allocations made while drawing the frame
+        size_t culledTriangles = 0; // raster frames only, triangles the hierarchical depth test rejected whole, once per tile
+        size_t skippedPixelTests = 0; // raster frames only, pixels the hierarchical depth test saved testing one by one
+    };
     enum RenderMode {
         WIRE_FRAME,
         RASTERISED,
@@ -20,12 +31,22 @@ public:
     float height;
     const bool show;
     bool mirror;
+    bool smoothLines = false; // wire frame edges are anti-aliased
+    bool frustumCulling = true; // objects wholly outside the view are skipped, only worth turning off to measure what it saves
     RenderMode renderMode;
     Light light;
-    std::vector<ModelTriangle> triangles;
+    std::shared_ptr<const Geometry> geometry; // read-only once built, so copies of the scene drawing other frames share it
+    std::vector<Material> materials; // indexed by Geometry::materialIds
+    std::shared_ptr<const BVH> bvh;
     Camera camera;
-    DrawingWindow window;
-    Scene(float width, float height, bool show, bool mirror, RenderMode renderMode, Light light, std::vector<ModelTriangle> triangles, Camera camera);
+    RenderTarget target; // the frame being drawn, which main shows in a DrawingWindow unless running headless
+    std::shared_ptr<ThreadPool> threadPool;
+    RasterisingUtils::Bins rasterBins;
+    std::vector<RasterisingUtils::VisibleObject> visibleObjects; // found by RasterisingUtils::cullObjects for the frame being drawn
+    FrameStats stats; // of the last frame drawn
+    Scene(float width, float height, bool show, bool mirror, RenderMode renderMode, Light light, Geometry geometry, std::vector<Material> materials, Camera camera);
+    Scene(float width, float height, bool show, bool mirror, RenderMode renderMode, Light light, Geometry geometry, std::vector<Material> materials, BVH bvh, Camera camera);
+    void setThreadCount(int threadCount);
     void moveLight(Camera::Axis axis, float sign);
     void draw();
 };
\ No newline at end of file
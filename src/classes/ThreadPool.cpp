@@ -0,0 +1,113 @@
+#include "ThreadPool.h"
+
+/// @brief Starts threadCount - 1 workers, the thread calling parallelFor does its share of the work as well
+ThreadPool::ThreadPool(int threadCount): job(nullptr), jobContext(nullptr), generation(0), remaining(0), active(0), stopping(false) {
+    if (threadCount < 1) threadCount = 1;
+    for (int i=0; i<threadCount; i++) {
+        this->queues.emplace_back(new Queue());
+        this->queues.back()->begin = this->queues.back()->end = 0;
+    }
+    for (int i=1; i<threadCount; i++) this->workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool() {
+    {
+        std::lock_guard<std::mutex> lock(this->mutex);
+        this->stopping = true;
+    }
+    this->wake.notify_all();
+    for (auto &worker : this->workers) worker.join();
+}
+
+int ThreadPool::size() const {
+    return (int) this->queues.size();
+}
+
+int ThreadPool::defaultThreadCount() {
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores == 0 ? 1 : (int) cores;
+}
+
+/// @brief Takes the next task from the front of our own queue, or steals one from the back of another thread's queue
+bool ThreadPool::popTask(size_t worker, size_t &task) {
+    {
+        Queue &own = *this->queues[worker];
+        std::lock_guard<std::mutex> lock(own.mutex);
+        if (own.begin < own.end) {
+            task = own.begin++;
+            return true;
+        }
+    }
+    for (size_t i=1; i<this->queues.size(); i++) {
+        Queue &victim = *this->queues[(worker + i) % this->queues.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.begin < victim.end) {
+            task = --victim.end;
+            return true;
+        }
+    }
+    return false;
+}
+
+/// @brief Runs tasks until every queue is empty, returning how many this thread completed
+size_t ThreadPool::runTasks(size_t worker) {
+    size_t task;
+    size_t completed = 0;
+    while (this->popTask(worker, task)) {
+        this->job(this->jobContext, task);
+        completed++;
+    }
+    return completed;
+}
+
+void ThreadPool::workerLoop(size_t worker) {
+    size_t seenGeneration = 0;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(this->mutex);
+            this->wake.wait(lock, [&] { return this->stopping || this->generation != seenGeneration; });
+            if (this->stopping) return;
+            seenGeneration = this->generation;
+            this->active++;
+        }
+        size_t completed = this->runTasks(worker);
+        {
+            std::lock_guard<std::mutex> lock(this->mutex);
+            this->remaining -= completed;
+            this->active--;
+        }
+        this->finished.notify_all();
+    }
+}
+
+/// @brief Runs job(context, i) for every i in [0, count), see parallelFor
+void ThreadPool::run(size_t count, void (*job)(const void *context, size_t task), const void *context) {
+    if (count == 0) return;
+    if (this->queues.size() == 1) {
+        for (size_t i=0; i<count; i++) job(context, i);
+        return;
+    }
+    std::unique_lock<std::mutex> lock(this->mutex);
+    // a worker that woke late for the last job may still be finding its queues empty, the tasks go in once it is out,
+    // and are published with the new generation in one go, so every worker that sees the generation also sees its tasks
+    this->finished.wait(lock, [&] { return this->active == 0; });
+    // hand each thread a contiguous block of tasks, neighbouring tasks tend to touch the same data
+    size_t threadCount = this->queues.size();
+    for (size_t worker=0; worker<threadCount; worker++) {
+        Queue &queue = *this->queues[worker];
+        std::lock_guard<std::mutex> queueLock(queue.mutex);
+        queue.begin = worker * count / threadCount;
+        queue.end = (worker + 1) * count / threadCount;
+    }
+    this->job = job;
+    this->jobContext = context;
+    this->remaining = count;
+    this->generation++;
+    lock.unlock();
+    this->wake.notify_all();
+    size_t completed = this->runTasks(0);
+    lock.lock();
+    this->remaining -= completed;
+    // workers must be out of runTasks before job can be replaced by the next call
+    this->finished.wait(lock, [&] { return this->remaining == 0 && this->active == 0; });
+}
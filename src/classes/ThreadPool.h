@@ -0,0 +1,47 @@
+#pragma once
+
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+class ThreadPool {
+private:
+    struct Queue {
+        std::mutex mutex;
+        size_t begin; // the owner takes tasks from the front of [begin, end), thieves from the back
+        size_t end;
+    };
+    std::vector<std::thread> workers;
+    std::vector<std::unique_ptr<Queue>> queues; // one per thread, the calling thread owns queues[0]
+    void (*job)(const void *context, size_t task); // type erased without copying the task, so a frame never allocates
+    const void *jobContext;
+    std::mutex mutex;
+    std::condition_variable wake;
+    std::condition_variable finished;
+    size_t generation;
+    size_t remaining;
+    size_t active; // workers currently inside runTasks
+    bool stopping;
+    bool popTask(size_t worker, size_t &task);
+    size_t runTasks(size_t worker);
+    void workerLoop(size_t worker);
+    void run(size_t count, void (*job)(const void *context, size_t task), const void *context);
+    template <typename Task>
+    static void invoke(const void *context, size_t task) {
+        (*static_cast<const Task *>(context))(task);
+    }
+public:
+    explicit ThreadPool(int threadCount);
+    ~ThreadPool();
+    ThreadPool(const ThreadPool &) = delete;
+    ThreadPool &operator=(const ThreadPool &) = delete;
+    int size() const;
+    /// @brief Calls task(i) for every i in [0, count) across all threads, returning once they have all finished
+    template <typename Task>
+    void parallelFor(size_t count, const Task &task) {
+        this->run(count, &ThreadPool::invoke<Task>, &task);
+    }
+    static int defaultThreadCount();
+};
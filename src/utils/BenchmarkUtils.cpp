@@ -0,0 +1,453 @@
+#include "BenchmarkUtils.h"
+#include <cfloat>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <filesystem>
+#include <random>
+#include <vector>
+#include <ModelTriangle.h>
+#include <Ray.h>
+#include "BVH.h"
+#include "Geometry.h"
+#include "ThreadPool.h"
+#include "MappedFile.h"
+#include "FilesUtils.h"
+#include "ImageUtils.h"
+#include "RenderUtils.h"
+#include "RayTracingUtils.h"
+#include "PacketUtils.h"
+#include "Camera.h"
+#include "Scene.h"
+
+namespace {
+    double millisecondsSince(std::chrono::steady_clock::time_point start) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    }
+
+    /// @brief Generates a bumpy grid of 2 * resolution^2 triangles spanning [-1, 1] in x and z
+    std::vector<ModelTriangle> generateTerrain(int resolution) {
+        std::vector<glm::vec3> points;
+        points.reserve((resolution + 1) * (resolution + 1));
+        for (int i=0; i<=resolution; i++) {
+            for (int j=0; j<=resolution; j++) {
+                float x = 2.f * j / resolution - 1.f;
+                float z = 2.f * i / resolution - 1.f;
+                float y = 0.1f * std::sin(9.f * x) * std::cos(7.f * z) + 0.05f * std::sin(31.f * x * z);
+                points.emplace_back(x, y, z);
+            }
+        }
+        std::vector<ModelTriangle> triangles;
+        triangles.reserve(2 * resolution * resolution);
+        for (int i=0; i<resolution; i++) {
+            for (int j=0; j<resolution; j++) {
+                int corner = i * (resolution + 1) + j;
+                triangles.emplace_back(points[corner], points[corner + 1], points[corner + resolution + 1], 0);
+                triangles.emplace_back(points[corner + 1], points[corner + resolution + 2], points[corner + resolution + 1], 0);
+            }
+        }
+        return triangles;
+    }
+
+    /// @brief Times closest-hit queries on growing meshes, cost per ray should grow with log2 of the triangle count
+    void bvhTraversal() {
+        const int rayCount = 200000;
+        std::printf("%12s %12s %12s %12s %16s\n", "triangles", "build (ms)", "ns/ray", "hit rate", "ns/ray/log2(n)");
+        for (int resolution=16; resolution<=1024; resolution*=2) {
+            Geometry geometry(generateTerrain(resolution));
+            auto start = std::chrono::steady_clock::now();
+            BVH bvh(geometry);
+            double buildTime = millisecondsSince(start);
+
+            std::mt19937 generator(42);
+            std::uniform_real_distribution<float> distribution(-1.f, 1.f);
+            std::vector<Ray> rays;
+            rays.reserve(rayCount);
+            glm::vec3 eye(0.f, 1.5f, 2.5f);
+            for (int i=0; i<rayCount; i++) {
+                glm::vec3 target(distribution(generator), 0.f, distribution(generator));
+                rays.emplace_back(eye, glm::normalize(target - eye));
+            }
+            int hits = 0;
+            start = std::chrono::steady_clock::now();
+            for (const auto &ray : rays) {
+                RayTriangleIntersection intersection = RayTracingUtils::findClosestTriangle(geometry, bvh, ray, false, -1);
+                if (intersection.distanceFromCamera != FLT_MAX) hits++;
+            }
+            double nsPerRay = millisecondsSince(start) * 1e6 / rayCount;
+            std::printf("%12zu %12.1f %12.1f %12.3f %16.2f\n", geometry.size(), buildTime, nsPerRay, (float) hits / rayCount, nsPerRay / std::log2((double) geometry.size()));
+        }
+    }
+
+    /// @brief Compares tracing a frame of primary rays one at a time against tracing them as SIMD packets
+    void packetTracing() {
+        const int size = 512;
+        Camera camera((float) size, (float) size, glm::vec3(0.f, 1.5f, 2.5f), false);
+        std::printf("packet width: %d\n", PacketUtils::packetWidth());
+        std::printf("%12s %16s %16s %10s\n", "triangles", "single (Mray/s)", "packet (Mray/s)", "speedup");
+        for (int resolution=16; resolution<=1024; resolution*=4) {
+            Geometry geometry(generateTerrain(resolution));
+            BVH bvh(geometry);
+            Camera::RayBatch batch;
+            int hits = 0;
+            auto start = std::chrono::steady_clock::now();
+            for (int y=0; y<size; y++) {
+                for (int x=0; x<size; x+=Camera::rayBatchSize) {
+                    camera.generateRays(x, y, batch);
+                    for (int i=0; i<Camera::rayBatchSize; i++) {
+                        RayTriangleIntersection intersection = RayTracingUtils::findClosestTriangle(geometry, bvh, batch.ray(i), false, -1);
+                        if (intersection.distanceFromCamera != FLT_MAX) hits++;
+                    }
+                }
+            }
+            double singleTime = millisecondsSince(start);
+            int packetHits = 0;
+            start = std::chrono::steady_clock::now();
+            for (int y=0; y<size; y++) {
+                for (int x=0; x<size; x+=Camera::rayBatchSize) {
+                    camera.generateRays(x, y, batch);
+                    PacketUtils::Hits packetResult;
+                    PacketUtils::findClosestTriangles(bvh, batch, Camera::rayBatchSize, packetResult);
+                    for (int i=0; i<Camera::rayBatchSize; i++) {
+                        if (packetResult.t[i] != FLT_MAX) packetHits++;
+                    }
+                }
+            }
+            double packetTime = millisecondsSince(start);
+            if (hits != packetHits) std::printf("hit counts differ: %d single, %d packet\n", hits, packetHits);
+            double rays = (double) size * size;
+            std::printf("%12zu %16.2f %16.2f %9.2fx\n", geometry.size(), rays / singleTime / 1e3, rays / packetTime / 1e3, singleTime / packetTime);
+        }
+    }
+
+    /// @brief Reports how many bytes per triangle each pass reads, with every field in one struct (AoS) and with separate streams (SoA)
+    void memoryLayout() {
+        Geometry geometry(generateTerrain(256));
+        double verticesPerTriangle = (double) geometry.vertexCount() / geometry.size();
+        double positions = 3 * sizeof(uint32_t) + verticesPerTriangle * 3 * sizeof(float);
+        double vertexNormals = verticesPerTriangle * 3 * sizeof(float);
+        double surfaceNormal = 3 * sizeof(float);
+        double material = sizeof(uint16_t);
+        std::printf("%-32s %10zu\n", "ModelTriangle (AoS)", sizeof(ModelTriangle));
+        std::printf("%-32s %10zu\n", "all streams (SoA)", geometry.bytesPerTriangle());
+        std::printf("%-32s %10s %10s\n", "pass", "AoS", "SoA");
+        std::printf("%-32s %10zu %10.1f\n", "rasterising", sizeof(ModelTriangle), positions + material);
+        std::printf("%-32s %10zu %10.1f\n", "shading a hit", sizeof(ModelTriangle), positions + vertexNormals + surfaceNormal + material);
+    }
+
+    /// @brief Times welding a triangle soup into an indexed mesh and generating its normals, both should grow linearly
+    void normalGeneration() {
+        ThreadPool threadPool(ThreadPool::defaultThreadCount());
+        std::printf("threads: %d\n", threadPool.size());
+        std::printf("%12s %12s %12s %14s\n", "triangles", "weld (ms)", "normals (ms)", "ns/triangle");
+        for (int resolution=64; resolution<=1024; resolution*=2) {
+            std::vector<ModelTriangle> triangles = generateTerrain(resolution);
+            auto start = std::chrono::steady_clock::now();
+            Geometry geometry(triangles);
+            double weldTime = millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            geometry.calculateNormals(threadPool);
+            double normalTime = millisecondsSince(start);
+            std::printf("%12zu %12.1f %12.1f %14.1f\n", geometry.size(), weldTime, normalTime, (weldTime + normalTime) * 1e6 / geometry.size());
+        }
+    }
+
+    /// @brief Stacks layers of tessellated quads facing the camera one behind another, nearest layer first unless reversed
+    std::vector<ModelTriangle> generateLayers(int layerCount, int resolution, bool reversed) {
+        std::vector<ModelTriangle> triangles;
+        triangles.reserve(2 * layerCount * resolution * resolution);
+        for (int layer=0; layer<layerCount; layer++) {
+            float z = -0.2f * (reversed ? layerCount - 1 - layer : layer);
+            for (int i=0; i<resolution; i++) {
+                for (int j=0; j<resolution; j++) {
+                    glm::vec3 corner(12.f * j / resolution - 6.f, 12.f * i / resolution - 6.f, z);
+                    glm::vec3 right(12.f / resolution, 0.f, 0.f);
+                    glm::vec3 up(0.f, 12.f / resolution, 0.f);
+                    triangles.emplace_back(corner, corner + right, corner + up, 0);
+                    triangles.emplace_back(corner + right, corner + right + up, corner + up, 0);
+                }
+            }
+        }
+        return triangles;
+    }
+
+    /// @brief Rasterises stacked layers with and without the hierarchical depth test, drawn front to back it can reject all but the nearest layer
+    void occlusionCulling() {
+        const int size = 480;
+        const int layerCount = 16;
+        const int resolution = 64;
+        Light light(glm::vec3(0.f, 1.f, 2.f), Light::PHONG, 0.15f, glm::vec3(255.f, 255.f, 255.f));
+        std::vector<Material> materials = {Material("White", Colour(255, 255, 255))};
+        std::printf("%d layers, %d triangles\n", layerCount, 2 * layerCount * resolution * resolution);
+        std::printf("%14s %8s %12s %14s %18s\n", "order", "culling", "frame (ms)", "culled tiles", "skipped tests");
+        for (bool reversed : {false, true}) {
+            Camera camera((float) size, (float) size, glm::vec3(0.f, 0.f, 4.f), false);
+            Scene scene((float) size, (float) size, false, false, Scene::RASTERISED, light, Geometry(generateLayers(layerCount, resolution, reversed)), materials, camera);
+            for (bool culling : {false, true}) {
+                scene.rasterBins.occlusionCulling = culling;
+                float best = 0.f;
+                for (int run=0; run<10; run++) {
+                    scene.draw();
+                    if (run == 0 || scene.stats.milliseconds < best) best = scene.stats.milliseconds;
+                }
+                std::printf("%14s %8s %12.2f %14zu %18zu\n", reversed ? "back to front" : "front to back", culling ? "on" : "off", best, scene.stats.culledTriangles, scene.stats.skippedPixelTests);
+            }
+        }
+    }
+
+    /// @brief Lays patches of terrain out in a grid on the ground, neighbouring patches in different materials so each is its own object
+    std::vector<ModelTriangle> generateField(int patchCount, int resolution) {
+        std::vector<ModelTriangle> patch = generateTerrain(resolution);
+        std::vector<ModelTriangle> triangles;
+        triangles.reserve(patchCount * patchCount * patch.size());
+        for (int i=0; i<patchCount; i++) {
+            for (int j=0; j<patchCount; j++) {
+                glm::vec3 offset(4.f * j - 2.f * patchCount, -3.f, 4.f * i - 2.f * patchCount);
+                for (const ModelTriangle &triangle : patch) {
+                    triangles.emplace_back(triangle.vertices[0] + offset, triangle.vertices[1] + offset, triangle.vertices[2] + offset, (i + j) % 2);
+                }
+            }
+        }
+        return triangles;
+    }
+
+    /// @brief Draws a field of objects that mostly lies outside the view, with and without culling the objects against the view frustum
+    void frustumCulling() {
+        const int size = 480;
+        const int patchCount = 32;
+        const int resolution = 16;
+        Light light(glm::vec3(0.f, 1.f, 2.f), Light::PHONG, 0.15f, glm::vec3(255.f, 255.f, 255.f));
+        std::vector<Material> materials = {Material("Green", Colour(60, 160, 60)), Material("Brown", Colour(140, 100, 60))};
+        Camera camera((float) size, (float) size, glm::vec3(0.f, 0.f, 4.f), false);
+        Scene scene((float) size, (float) size, false, false, Scene::RASTERISED, light, Geometry(generateField(patchCount, resolution)), materials, camera);
+        scene.light.softShadows = false;
+        std::printf("%zu objects, %zu triangles\n", scene.geometry->objects.size(), scene.geometry->size());
+        std::printf("%8s %12s %8s %12s %16s\n", "view", "renderer", "culling", "frame (ms)", "visible objects");
+        // ahead sees out to the horizon with sky above it, down sees only the ground just in front
+        for (bool down : {false, true}) {
+            scene.camera.lookAt(glm::vec3(0.f, down ? -1.f : 0.f, 3.f));
+            for (Scene::RenderMode renderMode : {Scene::RASTERISED, Scene::RAY_TRACED}) {
+                scene.renderMode = renderMode;
+                int runs = renderMode == Scene::RASTERISED ? 20 : 3;
+                for (bool culling : {false, true}) {
+                    scene.frustumCulling = culling;
+                    float best = 0.f;
+                    for (int run=0; run<runs; run++) {
+                        scene.draw();
+                        if (run == 0 || scene.stats.milliseconds < best) best = scene.stats.milliseconds;
+                    }
+                    std::printf("%8s %12s %8s %12.2f %16zu\n", down ? "down" : "ahead", renderMode == Scene::RASTERISED ? "rasterised" : "ray traced", culling ? "on" : "off", best, scene.visibleObjects.size());
+                }
+            }
+        }
+    }
+
+    /// @brief Draws the wire frame of a large field of objects, from a view that sees out to the horizon and one where most edges run off screen
+    void wireFrame() {
+        const int size = 480;
+        const int patchCount = 32;
+        const int resolution = 16;
+        Light light(glm::vec3(0.f, 1.f, 2.f), Light::PHONG, 0.15f, glm::vec3(255.f, 255.f, 255.f));
+        std::vector<Material> materials = {Material("Green", Colour(60, 160, 60)), Material("Brown", Colour(140, 100, 60))};
+        Camera camera((float) size, (float) size, glm::vec3(0.f, 0.f, 4.f), false);
+        Scene scene((float) size, (float) size, false, false, Scene::WIRE_FRAME, light, Geometry(generateField(patchCount, resolution)), materials, camera);
+        std::printf("%zu triangles\n", scene.geometry->size());
+        std::printf("%8s %14s %12s\n", "view", "lines", "frame (ms)");
+        for (bool down : {false, true}) {
+            scene.camera.lookAt(glm::vec3(0.f, down ? -1.f : 0.f, 3.f));
+            for (bool smooth : {false, true}) {
+                scene.smoothLines = smooth;
+                float best = 0.f;
+                for (int run=0; run<20; run++) {
+                    scene.draw();
+                    if (run == 0 || scene.stats.milliseconds < best) best = scene.stats.milliseconds;
+                }
+                std::printf("%8s %14s %12.2f\n", down ? "down" : "ahead", smooth ? "anti-aliased" : "aliased", best);
+            }
+        }
+    }
+
+    /// @brief Path of the generated terrain .obj, in the system's temporary directory so the source tree is never written to
+    std::string terrainOBJPath() {
+        std::error_code error;
+        std::filesystem::path directory = std::filesystem::temp_directory_path(error);
+        return std::filesystem::absolute(directory / "computer-graphics-benchmark-terrain.obj").string(); // absolute, so it is not looked up in resources/models
+    }
+
+    /// @brief Writes a terrain mesh to objPath as an .obj, false if the file could not be created
+    bool writeTerrainOBJ(const std::string &objPath, int resolution) {
+        std::vector<ModelTriangle> triangles = generateTerrain(resolution);
+        std::FILE *file = std::fopen(objPath.c_str(), "w");
+        if (file == nullptr) {
+            std::printf("could not write %s\n", objPath.c_str());
+            return false;
+        }
+        std::fprintf(file, "usemtl White\n");
+        for (size_t i=0; i<triangles.size(); i++) {
+            for (const auto &vertex : triangles[i].vertices) std::fprintf(file, "v %f %f %f\n", vertex.x, vertex.y, vertex.z);
+            std::fprintf(file, "f %zu/ %zu/ %zu/\n", 3 * i + 1, 3 * i + 2, 3 * i + 3);
+        }
+        std::fclose(file);
+        return true;
+    }
+
+    /// @brief Writes a terrain mesh as an .obj, parses it back and reports throughput
+    void objLoading() {
+        const int resolution = 1024;
+        std::string objFileName = terrainOBJPath();
+        if (!writeTerrainOBJ(objFileName, resolution)) return;
+        MappedFile file(objFileName);
+        double megabytes = file.size() / 1e6;
+        std::printf("%.1f MB, %d triangles\n", megabytes, 2 * resolution * resolution);
+        std::printf("%12s %12s %12s %12s\n", "threads", "load (ms)", "MB/s", "vertices");
+        for (int threadCount=1; threadCount<=ThreadPool::defaultThreadCount(); threadCount*=2) {
+            ThreadPool threadPool(threadCount);
+            std::vector<Material> materials;
+            double best = 0.0;
+            size_t vertexCount = 0;
+            for (int run=0; run<3; run++) {
+                auto start = std::chrono::steady_clock::now();
+                Geometry geometry = FilesUtils::loadOBJ(objFileName, "cornell-box.mtl", materials, threadPool);
+                double time = millisecondsSince(start);
+                if (run == 0 || time < best) best = time;
+                vertexCount = geometry.vertexCount();
+            }
+            std::printf("%12d %12.1f %12.1f %12zu\n", threadCount, best, megabytes / (best / 1e3), vertexCount);
+        }
+        std::remove(objFileName.c_str());
+    }
+
+    /// @brief Compares building a terrain scene from its .obj with reading it back from the scene cache
+    void sceneStartup() {
+        const int resolution = 1024;
+        std::string objFileName = terrainOBJPath();
+        std::string mtlFileName = "cornell-box.mtl";
+        std::string cacheFileName = objFileName + ".cache";
+        if (!writeTerrainOBJ(objFileName, resolution)) return;
+        ThreadPool threadPool(ThreadPool::defaultThreadCount());
+        glm::mat4 model(1.f);
+        std::printf("%d triangles, %d threads\n", 2 * resolution * resolution, threadPool.size());
+        std::printf("%12s %12s %12s %12s %12s\n", "", "hash (ms)", "load (ms)", "build (ms)", "total (ms)");
+        for (int run=0; run<3; run++) {
+            // what a start without a cache does: parse, calculate normals, build the BVH, then save the result
+            auto start = std::chrono::steady_clock::now();
+            uint64_t sourceHash = FilesUtils::hashSceneSources(objFileName, mtlFileName, model);
+            double hashTime = millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            std::vector<Material> materials;
+            Geometry geometry = FilesUtils::loadOBJ(objFileName, mtlFileName, materials, threadPool);
+            double loadTime = millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            geometry.calculateNormals(threadPool);
+            BVH bvh(geometry);
+            double buildTime = millisecondsSince(start);
+            FilesUtils::writeSceneCache(cacheFileName, sourceHash, geometry, materials, bvh);
+            std::printf("%12s %12.1f %12.1f %12.1f %12.1f\n", "obj", hashTime, loadTime, buildTime, hashTime + loadTime + buildTime);
+
+            start = std::chrono::steady_clock::now();
+            sourceHash = FilesUtils::hashSceneSources(objFileName, mtlFileName, model);
+            hashTime = millisecondsSince(start);
+            start = std::chrono::steady_clock::now();
+            bool cached = FilesUtils::readSceneCache(cacheFileName, sourceHash, geometry, materials, bvh);
+            loadTime = millisecondsSince(start);
+            if (!cached) {
+                std::printf("could not read back %s\n", cacheFileName.c_str());
+                break;
+            }
+            std::printf("%12s %12.1f %12.1f %12s %12.1f\n", "cache", hashTime, loadTime, "-", hashTime + loadTime);
+        }
+        std::remove(objFileName.c_str());
+        std::remove(cacheFileName.c_str());
+    }
+
+    /// @brief Encodes frames of the sequences in each output format, comparing throughput over the raw pixels and file size with PPM
+    void imageEncoding() {
+        const int size = 480;
+        const size_t frameStep = 8; // every 8th frame of each sequence
+        ThreadPool loaderThreads(ThreadPool::defaultThreadCount());
+        std::vector<Material> materials;
+        Geometry geometry = FilesUtils::loadOBJ("cornell-box.obj", "cornell-box.mtl", materials, loaderThreads);
+        if (geometry.size() == 0) return;
+        Light light(glm::vec3(0.3f, 0.6f, 1.3f), Light::PHONG, 0.15f, glm::vec3(255.f, 255.f, 255.f));
+        light.softShadows = true;
+        Camera camera((float) size, (float) size, glm::vec3(0.f, 0.f, 4.f), false);
+        Scene scene((float) size, (float) size, false, false, Scene::RASTERISED, light, std::move(geometry), std::move(materials), camera);
+        struct Source {
+            const char *name;
+            RenderUtils::Sequence sequence;
+            Scene::RenderMode renderMode;
+        };
+        // the navigation ray traced, soft shadows and all, stands in for frames with noise in them
+        const Source sources[] = {
+            {"wire frame", RenderUtils::WIRE_FRAME, Scene::WIRE_FRAME},
+            {"navigation", RenderUtils::RASTERISED_NAVIGATION, Scene::RASTERISED},
+            {"navigation ray traced", RenderUtils::RASTERISED_NAVIGATION, Scene::RAY_TRACED},
+        };
+        std::printf("%dx%d, every %zuth frame\n", size, size, frameStep);
+        std::printf("%22s %8s %8s %8s %12s %12s %10s\n", "sequence", "frames", "format", "threads", "MB/s", "KB/frame", "vs PPM");
+        for (const Source &source : sources) {
+            std::vector<glm::mat4> poses = RenderUtils::poses(source.sequence, camera);
+            std::vector<RenderTarget> frames;
+            scene.renderMode = source.renderMode;
+            for (size_t frame=0; frame<poses.size(); frame+=frameStep) {
+                scene.camera.setPose(poses[frame]);
+                scene.draw();
+                frames.push_back(scene.target);
+            }
+            double megabytes = frames.size() * 3.0 * size * size / 1e6; // the pixels as RGB, which every format starts from
+            size_t ppmBytes = 0;
+            for (ImageUtils::Format format : {ImageUtils::PPM, ImageUtils::QOI, ImageUtils::PNG}) {
+                // only PNG shares out the work of a frame
+                int maxThreads = format == ImageUtils::PNG ? ThreadPool::defaultThreadCount() : 1;
+                for (int threadCount=1; threadCount<=maxThreads; threadCount*=2) {
+                    ThreadPool threadPool(threadCount);
+                    double best = 0.0;
+                    size_t bytes = 0;
+                    for (int run=0; run<3; run++) {
+                        bytes = 0;
+                        auto start = std::chrono::steady_clock::now();
+                        for (const RenderTarget &frame : frames) bytes += ImageUtils::encode(frame, format, threadPool).size();
+                        double time = millisecondsSince(start);
+                        if (run == 0 || time < best) best = time;
+                    }
+                    if (format == ImageUtils::PPM) ppmBytes = bytes;
+                    std::printf("%22s %8zu %8s %8d %12.1f %12.1f %9.1f%%\n", source.name, frames.size(), ImageUtils::extension(format), threadCount, megabytes / (best / 1e3), bytes / 1e3 / frames.size(), 100.0 * bytes / ppmBytes);
+                }
+            }
+        }
+    }
+}
+
+namespace BenchmarkUtils {
+    /// @brief Runs the named benchmark, returning false if there is no benchmark with that name
+    bool run(const std::string &name) {
+        if (name == "bvh") {
+            bvhTraversal();
+        } else if (name == "normals") {
+            normalGeneration();
+        } else if (name == "loader") {
+            objLoading();
+        } else if (name == "occlusion") {
+            occlusionCulling();
+        } else if (name == "frustum") {
+            frustumCulling();
+        } else if (name == "wireframe") {
+            wireFrame();
+        } else if (name == "startup") {
+            sceneStartup();
+        } else if (name == "encoding") {
+            imageEncoding();
+        } else if (name == "memory") {
+            memoryLayout();
+        } else if (name == "packets") {
+            if (PacketUtils::packetWidth() == 0) {
+                std::printf("this build has no SIMD packet support\n");
+                return true;
+            }
+            packetTracing();
+        } else {
+            return false;
+        }
+        return true;
+    }
+}
@@ -0,0 +1,7 @@
+#pragma once
+
+#include <string>
+
+namespace BenchmarkUtils {
+    bool run(const std::string &name);
+}
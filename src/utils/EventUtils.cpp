@@ -51,7 +51,7 @@ namespace {
             case SDLK_f:
                 std::cout << "Saving..." << std::endl;
                 n = "output";
-                FilesUtils::saveAsImage(scene.window, n);
+                FilesUtils::saveAsImage(scene.target, n);
                 break;
             case SDLK_r:
                 std::cout << "Toggling mirror..." << std::endl;
@@ -61,10 +61,17 @@ namespace {
                 std::cout << "Toggling orbit..." << std::endl;
                 scene.camera.orbit = !scene.camera.orbit;
                 break;
+            case SDLK_i:
+                std::cout << "Toggling anti-aliased lines..." << std::endl;
+                scene.smoothLines = !scene.smoothLines;
+                break;
             case SDLK_x:
                 std::cout << "Toggling soft shadows..." << std::endl;
                 scene.light.softShadows = !scene.light.softShadows;
                 break;
+            case SDLK_p:
+                std::cout << "Last frame: " << scene.stats.milliseconds << "ms, " << scene.stats.allocations << " allocations, " << scene.stats.culledTriangles << " triangles culled, " << scene.stats.skippedPixelTests << " pixel tests skipped" << std::endl;
+                break;
             case SDLK_l:
                 std::cout << "Looking at world origin..." << std::endl;
                 scene.camera.lookAt({0.f, 0.f, 0.f});
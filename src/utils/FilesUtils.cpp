@@ -1,11 +1,34 @@
 #include "FilesUtils.h"
+#include "MappedFile.h"
+#include "ThreadPool.h"
+#include "BVH.h"
 #include <Utils.h>
 #include <algorithm>
+#include <atomic>
+#include <charconv>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
 #include <map>
+#include <string_view>
 #include <Colour.h>
 #include <glm/glm.hpp>
+#ifdef _WIN32
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
 
 namespace {
+    /// @brief Where a model file is, names are looked up in resources/models unless they are already absolute paths
+    std::string modelPath(const std::string &fileName) {
+        if (std::filesystem::path(fileName).is_absolute()) return fileName;
+        return "resources/models/" + fileName;
+    }
+
     /* Colour (.mtl) */
 
     int parseRawColour(std::string raw) {
@@ -19,86 +42,597 @@ namespace {
         return colour;
     }
 
+    glm::vec3 parseVectorValue(std::string line) {
+        std::vector<std::string> vectorRaw = split(line, ' ');
+        return {std::stof(vectorRaw[1]), std::stof(vectorRaw[2]), std::stof(vectorRaw[3])};
+    }
+
     std::string parseColourName(std::string line) {
-        return split(line, ' ')[1];
+        std::string name = split(line, ' ')[1];
+        if (!name.empty() && name.back() == '\r') name.pop_back();
+        return name;
     }
 
-    std::map<std::string, Colour> loadColours(std::string mtlFileName) {
-        std::map<std::string, Colour> colourMap;
-        std::vector<std::string> colourNames;
-        std::vector<Colour> colourValues;
-        std::ifstream filein("resources/models/" + mtlFileName); // "cornell-box.mtl"
+    /// @brief Reads every material in the .mtl file, a material's id is its position in the file
+    std::vector<Material> loadMaterials(std::string mtlFileName, std::map<std::string, uint16_t, std::less<>> &materialIds) {
+        std::vector<Material> materials;
+        std::ifstream filein(modelPath(mtlFileName)); // "cornell-box.mtl"
         for (std::string line; std::getline(filein, line); ) {
-            if (line[0] == 'n') {
-                colourNames.push_back(parseColourName(line));
-            } else if (line[0] == 'K') {
-                colourValues.push_back(parseColourValue(line));
+            if (line.rfind("newmtl ", 0) == 0) {
+                materialIds.insert({parseColourName(line), (uint16_t) materials.size()});
+                materials.emplace_back(parseColourName(line), Colour());
+            } else if (materials.empty()) {
+                continue;
+            } else if (line.rfind("Kd ", 0) == 0) {
+                materials.back().diffuse = parseColourValue(line);
+            } else if (line.rfind("Ks ", 0) == 0) {
+                materials.back().specular = parseVectorValue(line);
+            } else if (line.rfind("Ns ", 0) == 0) {
+                materials.back().shininess = std::stof(split(line, ' ')[1]);
+            } else if (line.rfind("refl ", 0) == 0) {
+                materials.back().reflectivity = std::stof(split(line, ' ')[1]); // not part of the .mtl spec, other readers skip it
+            } else if (line.rfind("cull ", 0) == 0) {
+                materials.back().backFaceCulling = std::stoi(split(line, ' ')[1]) != 0; // nor is this
             }
         }
-        for (int i=0; i<colourNames.size(); i++) {
-            colourMap.insert({colourNames[i], colourValues[i]});
-        }
-        return colourMap;
+        return materials;
     }
 
     /* Object (.obj) */
 
-    glm::vec3 parseVector(std::string line) {
-        std::vector<std::string> trianglePointRaw = split(line, ' ');
-        glm::vec3 trianglePoint = {std::stof(trianglePointRaw[1]), std::stof(trianglePointRaw[2]), std::stof(trianglePointRaw[3])};
-        return trianglePoint;
+    const size_t chunkSize = 1 << 20; // bytes of .obj text parsed per task
+    const uint16_t inheritedMaterial = UINT16_MAX; // faces before a chunk's first usemtl take the material the previous chunk ended on
+    const int32_t missing = -1; // corner has no texture coordinate or normal
+
+    /// @brief One corner of a triangle, indices are 0 based
+    struct Corner {
+        int32_t indices[3]; // position, texture coordinate and normal
+        uint8_t relative; // bit i is set while indices[i] was written as a negative index and still counts from the start of the chunk
+    };
+
+    /// @brief Everything parsed from one chunk of the .obj file, kept flat so a chunk only allocates as its arrays grow
+    struct ObjChunk {
+        std::vector<float> positions; // x, y, z of each v
+        std::vector<float> textureCoordinates; // u, v of each vt
+        std::vector<float> normals; // x, y, z of each vn
+        std::vector<Corner> corners; // three per triangle
+        std::vector<uint16_t> faceMaterials; // one per triangle
+        uint16_t material = inheritedMaterial; // material in use at the end of the chunk
+        bool hasAttributes = false; // some corner has a texture coordinate or normal
+    };
+
+    bool isSpace(char c) {
+        return c == ' ' || c == '\t' || c == '\r';
+    }
+
+    const char *skipSpaces(const char *p, const char *end) {
+        while (p < end && isSpace(*p)) p++;
+        return p;
+    }
+
+    const char *skipToken(const char *p, const char *end) {
+        while (p < end && !isSpace(*p) && *p != '\n') p++;
+        return p;
+    }
+
+    const char *nextLine(const char *p, const char *end) {
+        const char *newline = static_cast<const char *>(std::memchr(p, '\n', end - p));
+        return newline == nullptr ? end : newline + 1;
+    }
+
+    bool parseFloat(const char *&p, const char *end, float &value) {
+        p = skipSpaces(p, end);
+        if (p < end && *p == '+') p++;
+#if defined(__cpp_lib_to_chars)
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc()) return false;
+        p = result.ptr;
+        return true;
+#else
+        // no floating point from_chars in this standard library, strtof needs a terminated copy as the mapping is not
+        char token[64];
+        const char *tokenEnd = skipToken(p, end);
+        size_t length = std::min((size_t) (tokenEnd - p), sizeof(token) - 1);
+        std::memcpy(token, p, length);
+        token[length] = '\0';
+        char *parsedEnd;
+        value = std::strtof(token, &parsedEnd);
+        if (parsedEnd == token) return false;
+        p += parsedEnd - token;
+        return true;
+#endif
+    }
+
+    bool parseFloats(const char *&p, const char *end, int count, std::vector<float> &values) {
+        for (int i=0; i<count; i++) {
+            float value;
+            if (!parseFloat(p, end, value)) return false;
+            values.push_back(value);
+        }
+        return true;
+    }
+
+    bool parseIndex(const char *&p, const char *end, int32_t &value) {
+        if (p < end && *p == '+') p++;
+        std::from_chars_result result = std::from_chars(p, end, value);
+        if (result.ec != std::errc() || value == 0) return false;
+        p = result.ptr;
+        return true;
     }
 
-    int cleanFacet(std::string triangleRawItem) {
-        return std::stof(triangleRawItem.substr(0, triangleRawItem.size()-1));
+    bool startsWith(const char *p, const char *end, const char *keyword, size_t length) {
+        return (size_t) (end - p) > length && std::memcmp(p, keyword, length) == 0 && isSpace(p[length]);
     }
 
-    std::vector<int> parseFacet(std::string line) {
-        std::vector<std::string> triangleRaw = split(line, ' ');
-        std::vector<int> triangle = {cleanFacet(triangleRaw[1]), cleanFacet(triangleRaw[2]), cleanFacet(triangleRaw[3])};
-        return triangle;
+    /// @brief Reads one face corner, "v", "v/vt", "v//vn" or "v/vt/vn". Indices become 0 based, negative ones are made relative to the chunk start
+    bool parseCorner(const char *&p, const char *end, const int32_t *counts, ObjChunk &chunk, Corner &corner) {
+        corner = {{missing, missing, missing}, 0};
+        for (int attribute=0; attribute<3; attribute++) {
+            if (attribute > 0) {
+                if (p >= end || *p != '/') break;
+                p++;
+                if (p < end && (*p == '/' || isSpace(*p) || *p == '\n')) continue; // empty, as in v//vn
+            }
+            int32_t index;
+            if (!parseIndex(p, end, index)) return false;
+            corner.indices[attribute] = index > 0 ? index - 1 : counts[attribute] + index;
+            if (index < 0) corner.relative |= 1 << attribute;
+            if (attribute > 0) chunk.hasAttributes = true;
+        }
+        p = skipToken(p, end);
+        return true;
     }
 
-    std::vector<ModelTriangle> createTriangles(std::vector<glm::vec3> trianglePoints, std::vector<std::vector<int>> triangles, std::vector<std::string> colours, std::map<std::string, Colour> colourMap) {
-        std::vector<ModelTriangle> modelTriangles;
-        for (int i=0; i<triangles.size(); i++) {
-            Colour colour = colourMap.at(colours[i]);
-            ModelTriangle modelTriangle = {trianglePoints[triangles[i][0] - 1], trianglePoints[triangles[i][1] - 1], trianglePoints[triangles[i][2] - 1], colour};
-            //glm::vec3 normal = calculateSurfaceNormal(modelTriangle.vertices);
-            //modelTriangle.surfaceNormal = normal;
-            modelTriangles.push_back(modelTriangle);
+    /// @brief Parses the lines in [begin, end) that describe geometry, polygons are split into a fan of triangles
+    void parseChunk(const char *begin, const char *end, const std::map<std::string, uint16_t, std::less<>> &materialIds, ObjChunk &chunk) {
+        for (const char *line=begin; line<end; line=nextLine(line, end)) {
+            const char *p = skipSpaces(line, end);
+            if (startsWith(p, end, "v", 1)) {
+                p += 1;
+                if (!parseFloats(p, end, 3, chunk.positions)) chunk.positions.resize(chunk.positions.size() / 3 * 3);
+            } else if (startsWith(p, end, "vt", 2)) {
+                p += 2;
+                if (!parseFloats(p, end, 2, chunk.textureCoordinates)) chunk.textureCoordinates.resize(chunk.textureCoordinates.size() / 2 * 2);
+            } else if (startsWith(p, end, "vn", 2)) {
+                p += 2;
+                if (!parseFloats(p, end, 3, chunk.normals)) chunk.normals.resize(chunk.normals.size() / 3 * 3);
+            } else if (startsWith(p, end, "f", 1)) {
+                p += 1;
+                int32_t counts[3] = {(int32_t) chunk.positions.size() / 3, (int32_t) chunk.textureCoordinates.size() / 2, (int32_t) chunk.normals.size() / 3};
+                size_t faceStart = chunk.corners.size();
+                Corner first, previous, current;
+                int cornerCount = 0;
+                bool valid = true;
+                // corners go in as (first, previous, current) so an n-gon becomes a fan around its first corner
+                for (p=skipSpaces(p, end); p<end && *p!='\n'; p=skipSpaces(p, end)) {
+                    if (!parseCorner(p, end, counts, chunk, current)) {
+                        valid = false;
+                        break;
+                    }
+                    if (cornerCount == 0) first = current;
+                    if (cornerCount >= 2) {
+                        chunk.corners.insert(chunk.corners.end(), {first, previous, current});
+                        chunk.faceMaterials.push_back(chunk.material);
+                    }
+                    previous = current;
+                    cornerCount++;
+                }
+                if (!valid || cornerCount < 3) {
+                    chunk.corners.resize(faceStart);
+                    chunk.faceMaterials.resize(faceStart / 3);
+                }
+            } else if (startsWith(p, end, "usemtl", 6)) {
+                p = skipSpaces(p + 6, end);
+                std::string_view name(p, skipToken(p, end) - p);
+                auto material = materialIds.find(name);
+                if (material != materialIds.end()) chunk.material = material->second;
+            }
         }
-//        for (auto &triangle : modelTriangles) {
-//            triangle.vertexNormals = calculateVertexNormals(triangle, modelTriangles);
-//        }
-        return modelTriangles;
+    }
+
+    /// @brief Splits the file into chunks that start and end on line boundaries, parses them in parallel, then concatenates them
+    Geometry parseOBJ(const char *data, size_t size, const std::map<std::string, uint16_t, std::less<>> &materialIds, ThreadPool &threadPool) {
+        size_t chunkCount = std::max((size_t) 1, (size_t) ((size + chunkSize - 1) / chunkSize));
+        std::vector<const char *> boundaries(chunkCount + 1);
+        boundaries[0] = data;
+        boundaries[chunkCount] = data + size;
+        for (size_t i=1; i<chunkCount; i++) {
+            const char *start = std::max(boundaries[i - 1], data + i * size / chunkCount);
+            boundaries[i] = start == data ? data : nextLine(start - 1, data + size);
+        }
+        std::vector<ObjChunk> chunks(chunkCount);
+        threadPool.parallelFor(chunkCount, [&](size_t i) {
+            parseChunk(boundaries[i], boundaries[i + 1], materialIds, chunks[i]);
+        });
+
+        // offsets of each chunk in the merged arrays, and the material each chunk inherits
+        struct Offsets {
+            size_t attributes[3]; // positions, texture coordinates, normals
+            size_t triangles;
+        };
+        std::vector<Offsets> offsets(chunkCount + 1, Offsets());
+        std::vector<uint16_t> inheritedMaterials(chunkCount);
+        uint16_t material = 0;
+        bool hasAttributes = false;
+        for (size_t i=0; i<chunkCount; i++) {
+            const ObjChunk &chunk = chunks[i];
+            offsets[i + 1].attributes[0] = offsets[i].attributes[0] + chunk.positions.size() / 3;
+            offsets[i + 1].attributes[1] = offsets[i].attributes[1] + chunk.textureCoordinates.size() / 2;
+            offsets[i + 1].attributes[2] = offsets[i].attributes[2] + chunk.normals.size() / 3;
+            offsets[i + 1].triangles = offsets[i].triangles + chunk.faceMaterials.size();
+            inheritedMaterials[i] = material;
+            if (chunk.material != inheritedMaterial) material = chunk.material;
+            hasAttributes = hasAttributes || chunk.hasAttributes;
+        }
+        const Offsets &totals = offsets[chunkCount];
+        if (totals.attributes[0] == 0) return Geometry(); // nothing for faces to refer to
+        std::vector<glm::vec3> positions(totals.attributes[0]);
+        std::vector<glm::vec2> textureCoordinates(totals.attributes[1]);
+        std::vector<glm::vec3> normals(totals.attributes[2]);
+        std::vector<Corner> corners(3 * totals.triangles);
+        std::vector<uint16_t> faceMaterials(totals.triangles);
+        std::atomic<bool> outOfRange(false);
+        threadPool.parallelFor(chunkCount, [&](size_t i) {
+            ObjChunk &chunk = chunks[i];
+            std::memcpy(static_cast<void *>(positions.data() + offsets[i].attributes[0]), chunk.positions.data(), chunk.positions.size() * sizeof(float));
+            std::memcpy(static_cast<void *>(textureCoordinates.data() + offsets[i].attributes[1]), chunk.textureCoordinates.data(), chunk.textureCoordinates.size() * sizeof(float));
+            std::memcpy(static_cast<void *>(normals.data() + offsets[i].attributes[2]), chunk.normals.data(), chunk.normals.size() * sizeof(float));
+            for (size_t j=0; j<chunk.corners.size(); j++) {
+                Corner &corner = chunk.corners[j];
+                for (int attribute=0; attribute<3; attribute++) {
+                    int32_t &index = corner.indices[attribute];
+                    if (corner.relative & (1 << attribute)) index += (int32_t) offsets[i].attributes[attribute];
+                    else if (index == missing) continue;
+                    if (index < 0 || (size_t) index >= totals.attributes[attribute]) {
+                        outOfRange = true;
+                        index = attribute == 0 ? 0 : missing;
+                    }
+                }
+                corners[3 * offsets[i].triangles + j] = corner;
+            }
+            for (size_t j=0; j<chunk.faceMaterials.size(); j++) {
+                uint16_t faceMaterial = chunk.faceMaterials[j];
+                faceMaterials[offsets[i].triangles + j] = faceMaterial == inheritedMaterial ? inheritedMaterials[i] : faceMaterial;
+            }
+            chunk = ObjChunk(); // free the chunk as soon as it has been copied
+        });
+        if (outOfRange) std::cout << "Model has face indices outside its vertex lists, replaced them with defaults" << std::endl;
+
+        std::vector<uint32_t> indices(3 * totals.triangles);
+        if (!hasAttributes) {
+            // positions are the vertices as they are, so only they need welding
+            for (size_t i=0; i<indices.size(); i++) indices[i] = (uint32_t) corners[i].indices[0];
+            return Geometry(positions, {}, {}, indices, faceMaterials);
+        }
+        // every corner becomes its own vertex with the attributes it was given, welding merges the identical ones back together
+        std::vector<glm::vec3> cornerPositions(indices.size());
+        std::vector<glm::vec3> cornerNormals(normals.empty() ? 0 : indices.size());
+        std::vector<glm::vec2> cornerTextureCoordinates(textureCoordinates.empty() ? 0 : indices.size());
+        const size_t blockSize = 1 << 16;
+        threadPool.parallelFor((indices.size() + blockSize - 1) / blockSize, [&](size_t block) {
+            size_t blockEnd = std::min(indices.size(), (block + 1) * blockSize);
+            for (size_t i=block*blockSize; i<blockEnd; i++) {
+                const int32_t *corner = corners[i].indices;
+                indices[i] = (uint32_t) i;
+                cornerPositions[i] = positions[corner[0]];
+                if (!cornerNormals.empty() && corner[2] != missing) cornerNormals[i] = glm::normalize(normals[corner[2]]);
+                if (!cornerTextureCoordinates.empty() && corner[1] != missing) cornerTextureCoordinates[i] = textureCoordinates[corner[1]];
+            }
+        });
+        return Geometry(cornerPositions, cornerNormals, cornerTextureCoordinates, indices, faceMaterials);
+    }
+
+    /* Files written whole */
+
+    /// @brief Name to write path under before renaming it into place, unique to this process so processes writing the same file at once never write into each other's
+    std::string temporaryPath(const std::string &path) {
+#ifdef _WIN32
+        int processId = _getpid();
+#else
+        int processId = (int) getpid();
+#endif
+        return path + "." + std::to_string(processId) + ".tmp";
+    }
+
+    /// @brief Renames the temporary file over path if it was written in full, otherwise removes it, so path only ever holds a whole file
+    bool replaceWith(const std::string &temporary, const std::string &path, bool written) {
+        // std::rename fails on Windows when path already exists, std::filesystem::rename replaces it everywhere
+        std::error_code error;
+        if (written) std::filesystem::rename(temporary, path, error);
+        if (written && !error) return true;
+        std::remove(temporary.c_str());
+        return false;
+    }
+
+    /* Scene cache (.cache) */
+
+    const char cacheMagic[8] = {'C', 'G', 'S', 'C', 'E', 'N', 'E', '\0'};
+    const uint32_t cacheVersion = 4; // bump whenever the layout below, or how the cached geometry is built, changes
+    const size_t cacheAlignment = 64; // every section starts on a cache line
+    const uint32_t suppliedNormalsFlag = 1;
+
+    /// @brief First bytes of a cache file, the sections follow in the order writeSceneCache writes them
+    struct CacheHeader {
+        char magic[8];
+        uint32_t version;
+        uint32_t flags;
+        uint64_t sourceHash; // of the .obj, .mtl and model matrix the scene was built from
+        uint64_t payloadHash; // of every section after the header, a file torn or mixed up by another writer has some other hash
+        uint64_t vertexCount;
+        uint64_t triangleCount;
+        uint64_t materialCount;
+        uint64_t nodeCount;
+        uint64_t objectCount;
+        uint32_t nodeSize; // sizeof(BVH::Node) and sizeof(BVH::Triangle) of the build that wrote the file,
+        uint32_t triangleSize; // a build with a different layout rejects it rather than reading garbage
+    };
+
+    /// @brief Material in a fixed size record, names longer than the record are cut short
+    struct MaterialRecord {
+        char name[64];
+        int32_t diffuse[3];
+        float specular[3];
+        float shininess;
+        float reflectivity;
+        uint32_t backFaceCulling;
+    };
+
+    size_t paddedSize(size_t bytes) {
+        return (bytes + cacheAlignment - 1) / cacheAlignment * cacheAlignment;
+    }
+
+    /// @brief Mixes the bytes into the hash 8 at a time, fast enough to run over a large .obj on every start
+    uint64_t hashBytes(const char *data, size_t size, uint64_t hash) {
+        const uint64_t multiplier = 0x9E3779B97F4A7C15ull;
+        size_t i = 0;
+        for (; i+8<=size; i+=8) {
+            uint64_t word;
+            std::memcpy(&word, data + i, sizeof(word));
+            hash = (hash ^ word) * multiplier;
+            hash ^= hash >> 29;
+        }
+        for (; i<size; i++) {
+            hash = (hash ^ (uint8_t) data[i]) * multiplier;
+            hash ^= hash >> 29;
+        }
+        return (hash ^ size) * multiplier;
+    }
+
+    /// @brief Writes the section and its padding, mixing both into payloadHash
+    template <typename T>
+    void writeSection(std::FILE *file, const T *values, size_t count, uint64_t &payloadHash) {
+        static const char padding[cacheAlignment] = {};
+        size_t bytes = count * sizeof(T);
+        if (bytes > 0) std::fwrite(values, 1, bytes, file);
+        std::fwrite(padding, 1, paddedSize(bytes) - bytes, file);
+        payloadHash = hashBytes(reinterpret_cast<const char *>(values), bytes, payloadHash);
+        payloadHash = hashBytes(padding, paddedSize(bytes) - bytes, payloadHash);
+    }
+
+    /// @brief Copies the next section out of the mapping, mixing it into payloadHash as writeSection did, false if the file ends first
+    template <typename T>
+    bool readSection(const char *&p, const char *end, T *values, size_t count, uint64_t &payloadHash) {
+        size_t bytes = count * sizeof(T);
+        if ((size_t) (end - p) < bytes) return false;
+        if (bytes > 0) std::memcpy(static_cast<void *>(values), p, bytes);
+        size_t paddingBytes = std::min(paddedSize(bytes), (size_t) (end - p)) - bytes;
+        payloadHash = hashBytes(p, bytes, payloadHash);
+        payloadHash = hashBytes(p + bytes, paddingBytes, payloadHash);
+        p += bytes + paddingBytes;
+        return true;
+    }
+
+    /// @brief Whether sections of the sizes the header gives fit in the bytes after it, checked before anything is allocated
+    /// for them, as the payload hash does not cover the header and a damaged count could ask for any amount of memory
+    bool sectionsFit(const CacheHeader &header, size_t available) {
+        for (uint64_t count : {header.vertexCount, header.triangleCount, header.materialCount, header.nodeCount, header.objectCount}) {
+            if (count > available) return false; // keeps the sum below from overflowing
+        }
+        size_t vertexCount = header.vertexCount;
+        size_t triangleCount = header.triangleCount;
+        size_t bytes = 8 * paddedSize(vertexCount * sizeof(float)); // positions, vertex normals and texture coordinates
+        bytes += 3 * paddedSize(triangleCount * sizeof(float)); // surface normals
+        bytes += paddedSize(3 * triangleCount * sizeof(uint32_t));
+        bytes += paddedSize(triangleCount * sizeof(uint16_t));
+        bytes += paddedSize(header.materialCount * sizeof(MaterialRecord));
+        bytes += paddedSize(header.nodeCount * sizeof(BVH::Node));
+        bytes += paddedSize(triangleCount * sizeof(BVH::Triangle));
+        bytes += header.objectCount * sizeof(Geometry::Object); // the last section's padding may be cut off
+        return bytes <= available;
+    }
+
+    /// @brief Whether every index in the cached scene points inside the array it indexes, so nothing read back can send a lookup out of bounds
+    bool indicesInRange(const Geometry &geometry, size_t materialCount, const BVH &bvh) {
+        size_t vertexCount = geometry.vertexCount();
+        size_t triangleCount = geometry.size();
+        for (uint32_t index : geometry.indices) {
+            if (index >= vertexCount) return false;
+        }
+        for (uint16_t materialId : geometry.materialIds) {
+            if (materialId >= materialCount) return false;
+        }
+        for (const BVH::Node &node : bvh.nodes) {
+            if (node.count == 0 ? (size_t) node.leftFirst + 1 >= bvh.nodes.size() : (size_t) node.leftFirst + node.count > triangleCount) return false;
+        }
+        for (const BVH::Triangle &triangle : bvh.triangles) {
+            if (triangle.index >= triangleCount) return false;
+        }
+        for (const Geometry::Object &object : geometry.objects) {
+            if ((size_t) object.first + object.count > triangleCount) return false;
+        }
+        return true;
     }
 }
 
 namespace FilesUtils {
-    void saveAsImage(DrawingWindow &window, std::string &name) {
-        window.savePPM("output/" + name + ".ppm");
+    /// @brief Saves the frame as output/name.ppm, making output/ first if there is none yet
+    bool saveAsImage(RenderTarget &target, std::string &name) {
+        std::error_code error;
+        std::filesystem::create_directories("output", error); // a failure shows up as the file not being written
+        std::string fileName = "output/" + name + ".ppm";
+        std::string temporary = temporaryPath(fileName);
+        return replaceWith(temporary, fileName, target.savePPM(temporary));
     }
 
-    std::vector<ModelTriangle> loadOBJ(std::string objFileName, std::string mtlFileName) {
-        std::vector<glm::vec3> trianglePoints;
-        std::vector<std::vector<int>> triangles;
-        std::vector<std::string> colours;
-        std::map<std::string, Colour> colourMap = loadColours(mtlFileName);
-        std::ifstream filein("resources/models/" + objFileName); // "cornell-box.obj"
-        std::string lastColourName;
-        for (std::string line; std::getline(filein, line); ) {
-            if (line[0] == 'v') {
-                glm::vec3 trianglePoint = parseVector(line);
-                trianglePoints.push_back(trianglePoint);
-            } else if (line[0] == 'f') {
-                triangles.push_back(parseFacet(line));
-                colours.push_back(lastColourName);
-            } else if (line[0] == 'u') {
-                lastColourName = parseColourName(line);
-            }
+    /// @brief Saves the frame as output/name in the format, with its extension, written in one go once it is encoded.
+    /// It is written under a temporary name and renamed into place, so a process killed part way through never leaves a truncated frame behind
+    bool saveAsImage(const RenderTarget &target, const std::string &name, ImageUtils::Format format, ThreadPool &threadPool) {
+        std::error_code error;
+        std::filesystem::create_directories("output", error);
+        std::string fileName = "output/" + name + "." + ImageUtils::extension(format);
+        std::string temporary = temporaryPath(fileName);
+        std::vector<uint8_t> file = ImageUtils::encode(target, format, threadPool);
+        std::ofstream outputStream(temporary, std::ofstream::out | std::ofstream::binary);
+        if (!outputStream) {
+            std::cout << "Could not write " << fileName << std::endl;
+            return false;
+        }
+        outputStream.write(reinterpret_cast<const char *>(file.data()), (std::streamsize) file.size());
+        outputStream.close();
+        return replaceWith(temporary, fileName, !outputStream.fail());
+    }
+
+    /// @brief Loads the model as an indexed mesh, vertices repeated in the file are welded by Geometry
+    Geometry loadOBJ(std::string objFileName, std::string mtlFileName, std::vector<Material> &materials, ThreadPool &threadPool) {
+        std::map<std::string, uint16_t, std::less<>> materialIds;
+        materials = loadMaterials(mtlFileName, materialIds);
+        MappedFile file(modelPath(objFileName)); // "cornell-box.obj"
+        if (!file.isOpen()) {
+            std::cout << "Could not open " << objFileName << std::endl;
+            return Geometry();
+        }
+        return parseOBJ(file.data(), file.size(), materialIds, threadPool);
+    }
+
+    /// @brief Hash of everything a cached scene is built from, a cache with any other hash is stale
+    uint64_t hashSceneSources(std::string objFileName, std::string mtlFileName, const glm::mat4 &model) {
+        uint64_t hash = cacheVersion;
+        for (const std::string &fileName : {objFileName, mtlFileName}) {
+            MappedFile file(modelPath(fileName));
+            hash = hashBytes(file.data(), file.size(), hash);
+        }
+        return hashBytes(reinterpret_cast<const char *>(&model[0][0]), sizeof(model), hash);
+    }
+
+    /// @brief Reads back a scene written by writeSceneCache, false if the file is missing, stale or was written by an incompatible build
+    bool readSceneCache(std::string cacheFileName, uint64_t sourceHash, Geometry &geometry, std::vector<Material> &materials, BVH &bvh) {
+        MappedFile file(modelPath(cacheFileName));
+        if (!file.isOpen() || file.size() < sizeof(CacheHeader)) return false;
+        CacheHeader header;
+        std::memcpy(&header, file.data(), sizeof(header));
+        if (std::memcmp(header.magic, cacheMagic, sizeof(cacheMagic)) != 0 || header.version != cacheVersion) return false;
+        if (header.sourceHash != sourceHash) return false;
+        if (header.nodeSize != sizeof(BVH::Node) || header.triangleSize != sizeof(BVH::Triangle)) return false;
+
+        if (file.size() < paddedSize(sizeof(header)) || !sectionsFit(header, file.size() - paddedSize(sizeof(header)))) return false;
+
+        const char *p = file.data() + paddedSize(sizeof(header));
+        const char *end = file.data() + file.size();
+        size_t vertexCount = header.vertexCount;
+        size_t triangleCount = header.triangleCount;
+        Geometry cached;
+        cached.suppliedNormals = (header.flags & suppliedNormalsFlag) != 0;
+        cached.positions.resize(vertexCount);
+        cached.vertexNormals.resize(vertexCount);
+        cached.textureU.resize(vertexCount);
+        cached.textureV.resize(vertexCount);
+        cached.indices.resize(3 * triangleCount);
+        cached.surfaceNormals.resize(triangleCount);
+        cached.materialIds.resize(triangleCount);
+        std::vector<MaterialRecord> records(header.materialCount);
+        BVH cachedBVH;
+        cachedBVH.nodes.resize(header.nodeCount);
+        cachedBVH.triangles.resize(triangleCount);
+        cached.objects.resize(header.objectCount);
+        bool complete = true;
+        uint64_t payloadHash = cacheVersion;
+        for (Geometry::VectorStream *stream : {&cached.positions, &cached.vertexNormals, &cached.surfaceNormals}) {
+            complete = complete && readSection(p, end, stream->x.data(), stream->size(), payloadHash);
+            complete = complete && readSection(p, end, stream->y.data(), stream->size(), payloadHash);
+            complete = complete && readSection(p, end, stream->z.data(), stream->size(), payloadHash);
+        }
+        complete = complete && readSection(p, end, cached.textureU.data(), vertexCount, payloadHash);
+        complete = complete && readSection(p, end, cached.textureV.data(), vertexCount, payloadHash);
+        complete = complete && readSection(p, end, cached.indices.data(), cached.indices.size(), payloadHash);
+        complete = complete && readSection(p, end, cached.materialIds.data(), triangleCount, payloadHash);
+        complete = complete && readSection(p, end, records.data(), records.size(), payloadHash);
+        complete = complete && readSection(p, end, cachedBVH.nodes.data(), cachedBVH.nodes.size(), payloadHash);
+        complete = complete && readSection(p, end, cachedBVH.triangles.data(), triangleCount, payloadHash);
+        complete = complete && readSection(p, end, cached.objects.data(), cached.objects.size(), payloadHash);
+        if (!complete || payloadHash != header.payloadHash) return false;
+        if (!indicesInRange(cached, records.size(), cachedBVH)) return false;
+
+        materials.clear();
+        for (const MaterialRecord &record : records) {
+            Material material(std::string(record.name, strnlen(record.name, sizeof(record.name))), Colour(record.diffuse[0], record.diffuse[1], record.diffuse[2]));
+            material.specular = glm::vec3(record.specular[0], record.specular[1], record.specular[2]);
+            material.shininess = record.shininess;
+            material.reflectivity = record.reflectivity;
+            material.backFaceCulling = record.backFaceCulling != 0;
+            materials.push_back(material);
+        }
+        geometry = std::move(cached);
+        bvh = std::move(cachedBVH);
+        return true;
+    }
+
+    /// @brief Saves a scene whose geometry is already in world space with its normals and BVH built, so the next start can skip all of that
+    void writeSceneCache(std::string cacheFileName, uint64_t sourceHash, const Geometry &geometry, const std::vector<Material> &materials, const BVH &bvh) {
+        // written under a temporary name of this process's own and renamed into place, so a start that races this never maps half a file
+        // and processes building the cache at once never write into each other's file
+        std::string path = modelPath(cacheFileName);
+        std::string temporary = temporaryPath(path);
+        std::FILE *file = std::fopen(temporary.c_str(), "wb");
+        if (file == nullptr) {
+            std::cout << "Could not write " << cacheFileName << std::endl;
+            return;
+        }
+        CacheHeader header = {};
+        std::memcpy(header.magic, cacheMagic, sizeof(cacheMagic));
+        header.version = cacheVersion;
+        header.flags = geometry.suppliedNormals ? suppliedNormalsFlag : 0;
+        header.sourceHash = sourceHash;
+        header.vertexCount = geometry.vertexCount();
+        header.triangleCount = geometry.size();
+        header.materialCount = materials.size();
+        header.nodeCount = bvh.nodes.size();
+        header.objectCount = geometry.objects.size();
+        header.nodeSize = sizeof(BVH::Node);
+        header.triangleSize = sizeof(BVH::Triangle);
+        uint64_t headerHash = 0; // not part of the payload
+        writeSection(file, &header, 1, headerHash); // written again below, once the payload's hash is known
+        uint64_t payloadHash = cacheVersion;
+        for (const Geometry::VectorStream *stream : {&geometry.positions, &geometry.vertexNormals, &geometry.surfaceNormals}) {
+            writeSection(file, stream->x.data(), stream->size(), payloadHash);
+            writeSection(file, stream->y.data(), stream->size(), payloadHash);
+            writeSection(file, stream->z.data(), stream->size(), payloadHash);
+        }
+        writeSection(file, geometry.textureU.data(), geometry.textureU.size(), payloadHash);
+        writeSection(file, geometry.textureV.data(), geometry.textureV.size(), payloadHash);
+        writeSection(file, geometry.indices.data(), geometry.indices.size(), payloadHash);
+        writeSection(file, geometry.materialIds.data(), geometry.materialIds.size(), payloadHash);
+        std::vector<MaterialRecord> records(materials.size(), MaterialRecord());
+        for (size_t i=0; i<materials.size(); i++) {
+            const Material &material = materials[i];
+            MaterialRecord &record = records[i];
+            std::strncpy(record.name, material.name.c_str(), sizeof(record.name));
+            record.diffuse[0] = material.diffuse.red;
+            record.diffuse[1] = material.diffuse.green;
+            record.diffuse[2] = material.diffuse.blue;
+            for (int axis=0; axis<3; axis++) record.specular[axis] = material.specular[axis];
+            record.shininess = material.shininess;
+            record.reflectivity = material.reflectivity;
+            record.backFaceCulling = material.backFaceCulling;
         }
-        std::vector<ModelTriangle> modelTriangles = createTriangles(trianglePoints, triangles, colours, colourMap);
-        return modelTriangles;
+        writeSection(file, records.data(), records.size(), payloadHash);
+        writeSection(file, bvh.nodes.data(), bvh.nodes.size(), payloadHash);
+        writeSection(file, bvh.triangles.data(), bvh.triangles.size(), payloadHash);
+        writeSection(file, geometry.objects.data(), geometry.objects.size(), payloadHash);
+        header.payloadHash = payloadHash;
+        std::rewind(file);
+        std::fwrite(&header, 1, sizeof(header), file);
+        bool written = std::ferror(file) == 0;
+        written = std::fclose(file) == 0 && written;
+        if (!replaceWith(temporary, path, written)) std::cout << "Could not write " << cacheFileName << std::endl;
     }
 }
\ No newline at end of file
@@ -2,10 +2,21 @@
 
 #include <vector>
 #include <string>
-#include <ModelTriangle.h>
-#include <DrawingWindow.h>
+#include <cstdint>
+#include <glm/glm.hpp>
+#include <Material.h>
+#include "Geometry.h"
+#include <RenderTarget.h>
+#include "ImageUtils.h"
+
+class ThreadPool;
+class BVH;
 
 namespace FilesUtils {
-    std::vector<ModelTriangle> loadOBJ(std::string objFileName, std::string mtlFileName);
-    void saveAsImage(DrawingWindow &window, std::string &name);
+    Geometry loadOBJ(std::string objFileName, std::string mtlFileName, std::vector<Material> &materials, ThreadPool &threadPool);
+    uint64_t hashSceneSources(std::string objFileName, std::string mtlFileName, const glm::mat4 &model);
+    bool readSceneCache(std::string cacheFileName, uint64_t sourceHash, Geometry &geometry, std::vector<Material> &materials, BVH &bvh);
+    void writeSceneCache(std::string cacheFileName, uint64_t sourceHash, const Geometry &geometry, const std::vector<Material> &materials, const BVH &bvh);
+    bool saveAsImage(RenderTarget &target, std::string &name);
+    bool saveAsImage(const RenderTarget &target, const std::string &name, ImageUtils::Format format, ThreadPool &threadPool);
 }
\ No newline at end of file
@@ -0,0 +1,433 @@
+#include "ImageUtils.h"
+#include <algorithm>
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include "ThreadPool.h"
+
+namespace {
+    const size_t stripBytes = 1 << 16; // filtered PNG bytes deflated on their own, enough that restarting the dictionary at each costs little
+    const int hashBits = 15;
+    const int maxChain = 16; // earlier positions with the same hash tried for each match, more compresses better but slower
+    const size_t windowSize = 32768;
+    const size_t minMatch = 4;
+    const size_t maxMatch = 258;
+
+    void putBigEndian(std::vector<uint8_t> &out, uint32_t value) {
+        for (int shift=24; shift>=0; shift-=8) out.push_back((uint8_t) (value >> shift));
+    }
+
+    /* QOI, as specified at qoiformat.org. Pixels are always opaque so alpha never changes and is left out */
+
+    const uint8_t qoiIndex = 0x00;
+    const uint8_t qoiDiff = 0x40;
+    const uint8_t qoiLuma = 0x80;
+    const uint8_t qoiRun = 0xc0;
+    const uint8_t qoiRGB = 0xfe;
+    const int qoiMaxRun = 62;
+
+    /* PNG and its deflate stream, compressed with fixed Huffman codes so there are no code tables to build or send */
+
+    const uint16_t lengthBase[29] = {3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258};
+    const uint8_t lengthExtra[29] = {0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0};
+    const uint16_t distanceBase[30] = {1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577};
+    const uint8_t distanceExtra[30] = {0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13};
+
+    uint32_t reverseBits(uint32_t code, int length) {
+        uint32_t reversed = 0;
+        for (int i=0; i<length; i++) reversed |= ((code >> i) & 1) << (length - 1 - i);
+        return reversed;
+    }
+
+    /// @brief The fixed literal/length codes, bit reversed as deflate sends codes from their most significant bit
+    struct FixedCodes {
+        uint16_t code[288];
+        uint8_t length[288];
+        uint8_t lengthSymbol[maxMatch + 1]; // index into lengthBase for each match length
+        FixedCodes() {
+            for (int symbol=0; symbol<288; symbol++) {
+                int bits;
+                uint32_t value;
+                if (symbol < 144) bits = 8, value = 0x30 + symbol;
+                else if (symbol < 256) bits = 9, value = 0x190 + symbol - 144;
+                else if (symbol < 280) bits = 7, value = symbol - 256;
+                else bits = 8, value = 0xc0 + symbol - 280;
+                this->code[symbol] = (uint16_t) reverseBits(value, bits);
+                this->length[symbol] = (uint8_t) bits;
+            }
+            for (int i=0; i<29; i++) {
+                int end = i == 28 ? (int) maxMatch + 1 : lengthBase[i + 1];
+                for (int length=lengthBase[i]; length<end; length++) this->lengthSymbol[length] = (uint8_t) i;
+            }
+        }
+    };
+
+    const FixedCodes &fixedCodes() {
+        static const FixedCodes codes;
+        return codes;
+    }
+
+    /// @brief Writes deflate's bit stream, least significant bit first
+    struct BitWriter {
+        std::vector<uint8_t> &out;
+        uint64_t bits = 0;
+        int count = 0;
+        explicit BitWriter(std::vector<uint8_t> &_out): out(_out) {}
+        void put(uint32_t value, int length) {
+            this->bits |= (uint64_t) value << this->count;
+            this->count += length;
+            if (this->count >= 32) {
+                // whole 4 byte words at a time, 64 bits always has room for the at most 31 left over plus one more code
+                uint8_t word[4] = {(uint8_t) this->bits, (uint8_t) (this->bits >> 8), (uint8_t) (this->bits >> 16), (uint8_t) (this->bits >> 24)};
+                this->out.insert(this->out.end(), word, word + 4);
+                this->bits >>= 32;
+                this->count -= 32;
+            }
+        }
+        void align() {
+            while (this->count > 0) {
+                this->out.push_back((uint8_t) this->bits);
+                this->bits >>= 8;
+                this->count -= 8;
+            }
+            this->bits = 0;
+            this->count = 0;
+        }
+    };
+
+    void putLiteral(BitWriter &writer, const FixedCodes &codes, int symbol) {
+        writer.put(codes.code[symbol], codes.length[symbol]);
+    }
+
+    void putMatch(BitWriter &writer, const FixedCodes &codes, size_t length, size_t distance) {
+        int lengthIndex = codes.lengthSymbol[length];
+        putLiteral(writer, codes, 257 + lengthIndex);
+        writer.put((uint32_t) (length - lengthBase[lengthIndex]), lengthExtra[lengthIndex]);
+        int distanceIndex = (int) (std::upper_bound(distanceBase, distanceBase + 30, distance) - distanceBase) - 1;
+        writer.put(reverseBits((uint32_t) distanceIndex, 5), 5);
+        writer.put((uint32_t) (distance - distanceBase[distanceIndex]), distanceExtra[distanceIndex]);
+    }
+
+    uint32_t read32(const uint8_t *p) {
+        uint32_t value;
+        std::memcpy(&value, p, 4);
+        return value;
+    }
+
+    size_t matchLength(const uint8_t *a, const uint8_t *b, size_t limit) {
+        size_t length = 0;
+        while (length + 8 <= limit) {
+            uint64_t x, y;
+            std::memcpy(&x, a + length, 8);
+            std::memcpy(&y, b + length, 8);
+            if (x != y) break;
+            length += 8;
+        }
+        while (length < limit && a[length] == b[length]) length++;
+        return length;
+    }
+
+    /// @brief Deflates data as one fixed Huffman block, greedily taking the longest match found along a short hash chain.
+    /// Anything but the last strip ends in an empty stored block, which leaves the stream byte aligned for the next strip to follow
+    void deflateStrip(const uint8_t *data, size_t size, bool last, std::vector<uint8_t> &out) {
+        const FixedCodes &codes = fixedCodes();
+        std::vector<int32_t> head(1 << hashBits, -1);
+        std::vector<int32_t> previous(size);
+        BitWriter writer(out);
+        writer.put(last ? 1 : 0, 1);
+        writer.put(1, 2); // fixed Huffman codes
+        auto insert = [&](size_t position) {
+            uint32_t hash = (read32(data + position) * 2654435761u) >> (32 - hashBits);
+            previous[position] = head[hash];
+            head[hash] = (int32_t) position;
+            return previous[position];
+        };
+        size_t i = 0;
+        while (i < size) {
+            size_t bestLength = 0;
+            size_t bestDistance = 0;
+            if (i + minMatch <= size) {
+                size_t limit = std::min(maxMatch, size - i);
+                int32_t candidate = insert(i);
+                for (int chain=0; chain<maxChain && candidate >= 0 && i - candidate <= windowSize; chain++) {
+                    size_t length = matchLength(data + candidate, data + i, limit);
+                    if (length > bestLength) {
+                        bestLength = length;
+                        bestDistance = i - candidate;
+                        if (length == limit) break;
+                    }
+                    candidate = previous[candidate];
+                }
+            }
+            if (bestLength >= minMatch) {
+                putMatch(writer, codes, bestLength, bestDistance);
+                for (size_t j=i+1; j<i+bestLength && j+minMatch<=size; j++) insert(j);
+                i += bestLength;
+            } else {
+                putLiteral(writer, codes, data[i]);
+                i++;
+            }
+        }
+        putLiteral(writer, codes, 256); // end of block
+        if (!last) {
+            writer.put(0, 3); // stored, not final
+            writer.align();
+            out.insert(out.end(), {0x00, 0x00, 0xff, 0xff}); // a length of 0 and its complement
+        } else writer.align();
+    }
+
+    const uint32_t adlerModulus = 65521;
+
+    uint32_t adler32(const uint8_t *data, size_t size) {
+        uint32_t a = 1;
+        uint32_t b = 0;
+        while (size > 0) {
+            size_t block = std::min(size, (size_t) 5552); // the most bytes before b could overflow 32 bits
+            for (size_t i=0; i<block; i++) {
+                a += data[i];
+                b += a;
+            }
+            a %= adlerModulus;
+            b %= adlerModulus;
+            data += block;
+            size -= block;
+        }
+        return (b << 16) | a;
+    }
+
+    /// @brief Adler-32 of two pieces of data put together, from the checksum of each and the length of the second
+    uint32_t combineAdler32(uint32_t first, uint32_t second, size_t secondSize) {
+        uint32_t remainder = (uint32_t) (secondSize % adlerModulus);
+        uint32_t a = first & 0xffff;
+        uint32_t b = (uint32_t) (((uint64_t) remainder * a) % adlerModulus);
+        a += (second & 0xffff) + adlerModulus - 1;
+        b += (first >> 16) + (second >> 16) + adlerModulus - remainder;
+        if (a >= adlerModulus) a -= adlerModulus;
+        if (a >= adlerModulus) a -= adlerModulus;
+        if (b >= 2 * adlerModulus) b -= 2 * adlerModulus;
+        if (b >= adlerModulus) b -= adlerModulus;
+        return (b << 16) | a;
+    }
+
+    const std::array<uint32_t, 256> &crcTable() {
+        static const std::array<uint32_t, 256> table = []() {
+            std::array<uint32_t, 256> entries;
+            for (uint32_t n=0; n<256; n++) {
+                uint32_t c = n;
+                for (int k=0; k<8; k++) c = (c & 1) ? 0xedb88320u ^ (c >> 1) : c >> 1;
+                entries[n] = c;
+            }
+            return entries;
+        }();
+        return table;
+    }
+
+    void putChunk(std::vector<uint8_t> &out, const char *type, const uint8_t *data, size_t size) {
+        putBigEndian(out, (uint32_t) size);
+        size_t start = out.size();
+        out.insert(out.end(), type, type + 4);
+        out.insert(out.end(), data, data + size);
+        const std::array<uint32_t, 256> &table = crcTable();
+        uint32_t crc = 0xffffffffu;
+        for (size_t i=start; i<out.size(); i++) crc = table[(crc ^ out[i]) & 0xff] ^ (crc >> 8);
+        putBigEndian(out, crc ^ 0xffffffffu);
+    }
+
+    uint8_t paeth(int a, int b, int c) {
+        int p = a + b - c;
+        int pa = std::abs(p - a);
+        int pb = std::abs(p - b);
+        int pc = std::abs(p - c);
+        if (pa <= pb && pa <= pc) return (uint8_t) a;
+        return (uint8_t) (pb <= pc ? b : c);
+    }
+
+    /// @brief Writes the filter type then the filtered row, trying every filter and keeping the one whose bytes are closest to 0,
+    /// the usual guess at which will compress best. The row above the first is all 0
+    void filterRow(const uint8_t *row, const uint8_t *above, size_t rowBytes, uint8_t *out, std::vector<uint8_t> &candidate) {
+        const size_t bytesPerPixel = 3;
+        uint8_t *filtered = candidate.data();
+        size_t bestSum = SIZE_MAX;
+        for (uint8_t filter=0; filter<5; filter++) {
+            // the first pixel has nothing to its left, so each filter treats it as 0 there
+            switch (filter) {
+                case 0:
+                    std::memcpy(filtered, row, rowBytes);
+                    break;
+                case 1:
+                    for (size_t i=0; i<bytesPerPixel; i++) filtered[i] = row[i];
+                    for (size_t i=bytesPerPixel; i<rowBytes; i++) filtered[i] = (uint8_t) (row[i] - row[i - bytesPerPixel]);
+                    break;
+                case 2:
+                    for (size_t i=0; i<rowBytes; i++) filtered[i] = (uint8_t) (row[i] - above[i]);
+                    break;
+                case 3:
+                    for (size_t i=0; i<bytesPerPixel; i++) filtered[i] = (uint8_t) (row[i] - above[i] / 2);
+                    for (size_t i=bytesPerPixel; i<rowBytes; i++) filtered[i] = (uint8_t) (row[i] - (row[i - bytesPerPixel] + above[i]) / 2);
+                    break;
+                default:
+                    for (size_t i=0; i<bytesPerPixel; i++) filtered[i] = (uint8_t) (row[i] - above[i]);
+                    for (size_t i=bytesPerPixel; i<rowBytes; i++) filtered[i] = (uint8_t) (row[i] - paeth(row[i - bytesPerPixel], above[i], above[i - bytesPerPixel]));
+                    break;
+            }
+            size_t sum = 0;
+            for (size_t i=0; i<rowBytes; i++) sum += filtered[i] < 128 ? filtered[i] : 256 - filtered[i];
+            if (sum < bestSum) {
+                bestSum = sum;
+                out[0] = filter;
+                std::memcpy(out + 1, filtered, rowBytes);
+            }
+        }
+    }
+}
+
+namespace ImageUtils {
+    /// @brief The format with the given file extension, false if there is none
+    bool parseFormat(const std::string &name, Format &format) {
+        for (Format candidate : {PPM, QOI, PNG}) {
+            if (name == extension(candidate)) {
+                format = candidate;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    const char *extension(Format format) {
+        switch (format) {
+            case QOI:
+                return "qoi";
+            case PNG:
+                return "png";
+            default:
+                return "ppm";
+        }
+    }
+
+    std::vector<uint8_t> encodePPM(const RenderTarget &target) {
+        std::string header = "P6\n" + std::to_string(target.width) + " " + std::to_string(target.height) + "\n255\n";
+        std::vector<uint8_t> file(header.size() + 3 * target.width * target.height);
+        std::copy(header.begin(), header.end(), file.begin());
+        target.packRGB(0, target.width * target.height, &file[header.size()]);
+        return file;
+    }
+
+    std::vector<uint8_t> encodeQOI(const RenderTarget &target) {
+        size_t pixelCount = target.width * target.height;
+        std::vector<uint8_t> file;
+        file.reserve(14 + 4 * pixelCount + 8);
+        file.insert(file.end(), {'q', 'o', 'i', 'f'});
+        putBigEndian(file, (uint32_t) target.width);
+        putBigEndian(file, (uint32_t) target.height);
+        file.push_back(3); // channels
+        file.push_back(0); // sRGB with linear alpha
+        const uint32_t *pixels = target.getPixels();
+        uint32_t seen[64] = {}; // by hash of the colour, all transparent black to start with
+        uint32_t previous = 0xff000000u;
+        int run = 0;
+        for (size_t i=0; i<pixelCount; i++) {
+            uint32_t pixel = pixels[i] | 0xff000000u;
+            if (pixel == previous) {
+                run++;
+                if (run == qoiMaxRun || i + 1 == pixelCount) {
+                    file.push_back((uint8_t) (qoiRun | (run - 1)));
+                    run = 0;
+                }
+                continue;
+            }
+            if (run > 0) {
+                file.push_back((uint8_t) (qoiRun | (run - 1)));
+                run = 0;
+            }
+            uint8_t r = (uint8_t) (pixel >> 16);
+            uint8_t g = (uint8_t) (pixel >> 8);
+            uint8_t b = (uint8_t) pixel;
+            int hash = (r * 3 + g * 5 + b * 7 + 255 * 11) % 64;
+            if (seen[hash] == pixel) {
+                file.push_back((uint8_t) (qoiIndex | hash));
+            } else {
+                seen[hash] = pixel;
+                int8_t dr = (int8_t) (r - (uint8_t) (previous >> 16));
+                int8_t dg = (int8_t) (g - (uint8_t) (previous >> 8));
+                int8_t db = (int8_t) (b - (uint8_t) previous);
+                int drg = dr - dg;
+                int dbg = db - dg;
+                if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+                    file.push_back((uint8_t) (qoiDiff | (dr + 2) << 4 | (dg + 2) << 2 | (db + 2)));
+                } else if (dg >= -32 && dg <= 31 && drg >= -8 && drg <= 7 && dbg >= -8 && dbg <= 7) {
+                    file.push_back((uint8_t) (qoiLuma | (dg + 32)));
+                    file.push_back((uint8_t) ((drg + 8) << 4 | (dbg + 8)));
+                } else {
+                    file.insert(file.end(), {qoiRGB, r, g, b});
+                }
+            }
+            previous = pixel;
+        }
+        file.insert(file.end(), {0, 0, 0, 0, 0, 0, 0, 1});
+        return file;
+    }
+
+    /// @brief Filters and deflates strips of rows on separate threads. Strips are a fixed size, so the file does not depend on the thread count
+    std::vector<uint8_t> encodePNG(const RenderTarget &target, ThreadPool &threadPool) {
+        size_t width = target.width;
+        size_t height = target.height;
+        size_t rowBytes = 3 * width;
+        size_t stripRows = std::max((size_t) 1, stripBytes / (rowBytes + 1));
+        size_t stripCount = (height + stripRows - 1) / stripRows;
+        std::vector<uint8_t> rgb(rowBytes * height);
+        threadPool.parallelFor(stripCount, [&](size_t strip) {
+            size_t first = strip * stripRows;
+            size_t rows = std::min(stripRows, height - first);
+            target.packRGB(first * width, rows * width, &rgb[first * rowBytes]);
+        });
+        std::vector<std::vector<uint8_t>> compressed(stripCount);
+        std::vector<uint32_t> checksums(stripCount);
+        std::vector<size_t> filteredSizes(stripCount);
+        threadPool.parallelFor(stripCount, [&](size_t strip) {
+            size_t first = strip * stripRows;
+            size_t rows = std::min(stripRows, height - first);
+            std::vector<uint8_t> filtered(rows * (rowBytes + 1));
+            std::vector<uint8_t> candidate(rowBytes);
+            std::vector<uint8_t> zeros(first == 0 ? rowBytes : 0);
+            for (size_t y=first; y<first+rows; y++) {
+                const uint8_t *above = y > 0 ? &rgb[(y - 1) * rowBytes] : zeros.data();
+                filterRow(&rgb[y * rowBytes], above, rowBytes, &filtered[(y - first) * (rowBytes + 1)], candidate);
+            }
+            checksums[strip] = adler32(filtered.data(), filtered.size());
+            filteredSizes[strip] = filtered.size();
+            compressed[strip].reserve(filtered.size() / 4);
+            deflateStrip(filtered.data(), filtered.size(), strip + 1 == stripCount, compressed[strip]);
+        });
+
+        std::vector<uint8_t> stream = {0x78, 0x01}; // deflate with a 32K window, no preset dictionary
+        uint32_t checksum = 1;
+        for (size_t strip=0; strip<stripCount; strip++) {
+            stream.insert(stream.end(), compressed[strip].begin(), compressed[strip].end());
+            checksum = combineAdler32(checksum, checksums[strip], filteredSizes[strip]);
+        }
+        if (stripCount == 0) stream.insert(stream.end(), {0x03, 0x00}); // an empty final block
+        putBigEndian(stream, checksum);
+
+        std::vector<uint8_t> file = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+        std::vector<uint8_t> header;
+        putBigEndian(header, (uint32_t) width);
+        putBigEndian(header, (uint32_t) height);
+        header.insert(header.end(), {8, 2, 0, 0, 0}); // 8 bit RGB, deflate, adaptive filters, no interlacing
+        file.reserve(stream.size() + 64);
+        putChunk(file, "IHDR", header.data(), header.size());
+        putChunk(file, "IDAT", stream.data(), stream.size());
+        putChunk(file, "IEND", nullptr, 0);
+        return file;
+    }
+
+    std::vector<uint8_t> encode(const RenderTarget &target, Format format, ThreadPool &threadPool) {
+        switch (format) {
+            case QOI:
+                return encodeQOI(target);
+            case PNG:
+                return encodePNG(target, threadPool);
+            default:
+                return encodePPM(target);
+        }
+    }
+}
@@ -0,0 +1,22 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <RenderTarget.h>
+
+class ThreadPool;
+
+namespace ImageUtils {
+    enum Format {
+        PPM, // uncompressed
+        QOI, // lossless, compressed in one quick pass
+        PNG, // lossless and smaller, deflated in strips of rows across threads
+    };
+    bool parseFormat(const std::string &name, Format &format);
+    const char *extension(Format format);
+    std::vector<uint8_t> encodePPM(const RenderTarget &target);
+    std::vector<uint8_t> encodeQOI(const RenderTarget &target);
+    std::vector<uint8_t> encodePNG(const RenderTarget &target, ThreadPool &threadPool);
+    std::vector<uint8_t> encode(const RenderTarget &target, Format format, ThreadPool &threadPool);
+}
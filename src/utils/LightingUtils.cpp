@@ -24,20 +24,19 @@ namespace {
         return glm::max(incidenceAngle, 0.f);
     }
 
-    float calculateSpecularIntensity(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 lightDir, float incidenceAngle, glm::vec3 pointNormal) {
+    float calculateSpecularIntensity(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 lightDir, float incidenceAngle, glm::vec3 pointNormal, float shininess) {
         if (incidenceAngle <= 0.f) return 0.f;
-        float specularIntensity = 0.5f;
-        float specularFactor = 16.f;
         glm::vec3 reflectDir = glm::reflect(-lightDir, pointNormal);
         glm::vec3 viewDir = glm::normalize(scene.camera.position - closestTriangle.intersectionPoint);
         float specularAngle = glm::max(glm::dot(reflectDir, viewDir), 0.05f);
-        return pow(specularAngle, specularFactor) * specularIntensity;
+        return pow(specularAngle, shininess);
     }
 
 //    Colour applyProximityLighting(Scene &scene, RayTriangleIntersection &closestTriangle) {
 //        float distance = glm::length(scene.light.position - closestTriangle.intersectionPoint);
 //        float proximityIntensity = calculateProximityIntensity(distance);
-//        glm::vec3 diffuseColour = {closestTriangle.intersectedTriangle.colour.red, closestTriangle.intersectedTriangle.colour.green, closestTriangle.intersectedTriangle.colour.blue};
+//        const Colour &diffuse = scene.materials[closestTriangle.materialId].diffuse;
+//        glm::vec3 diffuseColour = {diffuse.red, diffuse.green, diffuse.blue};
 //        glm::vec3 colour(
 //            (diffuseColour * proximityIntensity) +
 //            (diffuseColour * scene.light.ambientIntensity)
@@ -45,27 +44,26 @@ namespace {
 //        return vectorToColour(colour);
 //    }
 
-    Colour applyPhongLighting(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 pointNormal) {
+    Colour applyPhongLighting(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 pointNormal, float blockerDistance) {
         float distance = glm::length(scene.light.position - closestTriangle.intersectionPoint);
         float proximityIntensity = calculateProximityIntensity(distance);
-        glm::vec3 diffuseColour = {closestTriangle.intersectedTriangle.colour.red, closestTriangle.intersectedTriangle.colour.green, closestTriangle.intersectedTriangle.colour.blue};
+        const Material &material = scene.materials[closestTriangle.materialId];
+        glm::vec3 diffuseColour = {material.diffuse.red, material.diffuse.green, material.diffuse.blue};
         glm::vec3 lightDir = glm::normalize(scene.light.position - closestTriangle.intersectionPoint);
 
         float incidenceAngle = calculateIncidenceAngle(scene, closestTriangle, lightDir, pointNormal);
-        float specularIntensity = calculateSpecularIntensity(scene, closestTriangle, lightDir, incidenceAngle, pointNormal);
+        float specularIntensity = calculateSpecularIntensity(scene, closestTriangle, lightDir, incidenceAngle, pointNormal, material.shininess);
         float shadowIntensity = 1.f;
-        glm::vec3 shadowIntersection = RayTracingUtils::canSeeLight(scene, closestTriangle);
-        if (shadowIntersection != glm::vec3(-1.f, -1.f, -1.f)) {
+        if (blockerDistance >= 0.f) {
             if (scene.light.softShadows) {
-                float dist = glm::length(shadowIntersection - closestTriangle.intersectionPoint);
-                shadowIntensity = glm::clamp(dist/2.8f + 0.5f, 0.f, 1.f);
+                shadowIntensity = glm::clamp(blockerDistance/2.8f + 0.5f, 0.f, 1.f);
             }
             incidenceAngle = 0.f;
             specularIntensity = 0.f;
         }
         glm::vec3 colour(
             (diffuseColour * proximityIntensity * incidenceAngle) +
-            (scene.light.colour * proximityIntensity * specularIntensity) +
+            (scene.light.colour * material.specular * proximityIntensity * specularIntensity) +
             (diffuseColour * scene.light.ambientIntensity * shadowIntensity)
         );
         return vectorToColour(colour);
@@ -74,13 +72,20 @@ namespace {
 
 namespace LightingUtils {
     Colour applyLighting(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 pointNormal) {
+        float blockerDistance = -1.f;
+        if (scene.light.mode == Light::PHONG) blockerDistance = RayTracingUtils::canSeeLight(scene, closestTriangle);
+        return applyLighting(scene, closestTriangle, pointNormal, blockerDistance);
+    }
+
+    /// @brief As above, for when the shadow ray has already been traced (blockerDistance as returned by canSeeLight)
+    Colour applyLighting(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 pointNormal, float blockerDistance) {
         Colour colour;
         switch (scene.light.mode) {
             case Light::DEFAULT:
-                colour = closestTriangle.intersectedTriangle.colour;
+                colour = scene.materials[closestTriangle.materialId].diffuse;
                 break;
             case Light::PHONG:
-                colour = applyPhongLighting(scene, closestTriangle, pointNormal);
+                colour = applyPhongLighting(scene, closestTriangle, pointNormal, blockerDistance);
                 break;
             default:
                 break;
@@ -88,25 +93,24 @@ namespace LightingUtils {
         return colour;
     }
 
-    /// @brief Checks if the provided colour is equal to the object colour we have set to be a mirror
-    bool isMirror(Colour &colour) {
-        Colour mirrorColour(178, 178, 178);
-        if (colour == mirrorColour) return true;
-        return false;
+    /// @brief Checks if the material was marked as reflective in the .mtl file
+    bool isMirror(const Material &material) {
+        return material.reflectivity > 0.f;
     }
 
     Colour applyMirror(Scene &scene, RayTriangleIntersection &closestTriangle) {
-        if (!isMirror(closestTriangle.intersectedTriangle.colour)) return closestTriangle.intersectedTriangle.colour;
+        const Material &material = scene.materials[closestTriangle.materialId];
+        if (!isMirror(material)) return material.diffuse;
         glm::vec3 viewDir = glm::normalize(scene.camera.position - closestTriangle.intersectionPoint);
-        glm::vec3 reflectDir = glm::reflect(-viewDir, glm::normalize(closestTriangle.intersectedTriangle.surfaceNormal));
+        glm::vec3 reflectDir = glm::reflect(-viewDir, glm::normalize(scene.geometry->surfaceNormals.get(closestTriangle.triangleIndex)));
         Ray ray(closestTriangle.intersectionPoint, reflectDir);
         RayTriangleIntersection newClosestTriangle = RayTracingUtils::findClosestTriangle(scene, ray, true, closestTriangle.triangleIndex);
         if (newClosestTriangle.distanceFromCamera == FLT_MAX) {
             return {0, 0, 0}; // looking out into the ether
         }
-        glm::vec3 pointNormal = RayTracingUtils::calculatePointNormal(newClosestTriangle.intersectedTriangle, newClosestTriangle.intersectionPoint);
+        glm::vec3 pointNormal = RayTracingUtils::calculatePointNormal(*scene.geometry, newClosestTriangle);
         Colour colour = LightingUtils::applyLighting(scene, newClosestTriangle, pointNormal);
-        float modifier = 0.85; // bit darker to make it more realistic
+        float modifier = material.reflectivity; // the fraction of light the mirror reflects, from refl in the .mtl
         // FIXME: can make this smarter by accounting for total distance (light -> triangle + triangle -> mirror + mirror -> eye)
         colour.red *= modifier;
         colour.green *= modifier;
@@ -1,11 +1,14 @@
 #pragma once
 
 #include <RayTriangleIntersection.h>
+#include <Colour.h>
+#include <Material.h>
 
 class Scene;
 
 namespace LightingUtils {
     Colour applyLighting(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 pointNormal);
-    bool isMirror(Colour &colour);
+    Colour applyLighting(Scene &scene, RayTriangleIntersection &closestTriangle, glm::vec3 pointNormal, float blockerDistance);
+    bool isMirror(const Material &material);
     Colour applyMirror(Scene &scene, RayTriangleIntersection &closestTriangle);
 }
\ No newline at end of file
@@ -0,0 +1,135 @@
+#include "MemoryUtils.h"
+#include <atomic>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+
+namespace {
+    std::atomic<size_t> allocations(0);
+
+    void *allocate(size_t size) {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        void *pointer = std::malloc(size == 0 ? 1 : size);
+        if (pointer == nullptr) throw std::bad_alloc();
+        return pointer;
+    }
+}
+
+// every heap allocation in the program goes through these, so they can be counted
+void *operator new(size_t size) {
+    return allocate(size);
+}
+
+void *operator new[](size_t size) {
+    return allocate(size);
+}
+
+void operator delete(void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, size_t) noexcept {
+    std::free(pointer);
+}
+
+// over-aligned types (such as the depth buffer's blocks) come through these instead, and are counted the same way
+void *operator new(size_t size, std::align_val_t alignment) {
+    return MemoryUtils::allocateAligned(size, (size_t) alignment);
+}
+
+void *operator new[](size_t size, std::align_val_t alignment) {
+    return MemoryUtils::allocateAligned(size, (size_t) alignment);
+}
+
+void operator delete(void *pointer, std::align_val_t) noexcept {
+    MemoryUtils::freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t) noexcept {
+    MemoryUtils::freeAligned(pointer);
+}
+
+void operator delete(void *pointer, size_t, std::align_val_t) noexcept {
+    MemoryUtils::freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, size_t, std::align_val_t) noexcept {
+    MemoryUtils::freeAligned(pointer);
+}
+
+// and the nothrow forms, which return null rather than throwing
+void *operator new(size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return allocate(size);
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, const std::nothrow_t &) noexcept {
+    try {
+        return allocate(size);
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void *operator new(size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    try {
+        return MemoryUtils::allocateAligned(size, (size_t) alignment);
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void *operator new[](size_t size, std::align_val_t alignment, const std::nothrow_t &) noexcept {
+    try {
+        return MemoryUtils::allocateAligned(size, (size_t) alignment);
+    } catch (const std::bad_alloc &) {
+        return nullptr;
+    }
+}
+
+void operator delete(void *pointer, const std::nothrow_t &) noexcept {
+    std::free(pointer);
+}
+
+void operator delete[](void *pointer, const std::nothrow_t &) noexcept {
+    std::free(pointer);
+}
+
+void operator delete(void *pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+    MemoryUtils::freeAligned(pointer);
+}
+
+void operator delete[](void *pointer, std::align_val_t, const std::nothrow_t &) noexcept {
+    MemoryUtils::freeAligned(pointer);
+}
+
+namespace MemoryUtils {
+    /// @brief Number of times any form of operator new has been called since the program started
+    size_t allocationCount() {
+        return allocations.load(std::memory_order_relaxed);
+    }
+
+    /// @brief Over-allocates with operator new and rounds up, keeping the original pointer just before the aligned block
+    void *allocateAligned(size_t bytes, size_t alignment) {
+        char *raw = static_cast<char *>(::operator new(bytes + alignment + sizeof(void *)));
+        uintptr_t aligned = ((uintptr_t) (raw + sizeof(void *)) + alignment - 1) & ~(uintptr_t) (alignment - 1);
+        reinterpret_cast<void **>(aligned)[-1] = raw;
+        return reinterpret_cast<void *>(aligned);
+    }
+
+    void freeAligned(void *pointer) {
+        if (pointer == nullptr) return;
+        ::operator delete(static_cast<void **>(pointer)[-1]);
+    }
+}
@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstddef>
+
+namespace MemoryUtils {
+    const size_t simdAlignment = 32; // wide enough for an AVX register
+    size_t allocationCount();
+    void *allocateAligned(size_t bytes, size_t alignment);
+    void freeAligned(void *pointer);
+
+    /// @brief Lets standard containers hand out storage starting on an alignment boundary, so streams can be loaded straight into SIMD registers
+    template <typename T, size_t Alignment = simdAlignment>
+    struct AlignedAllocator {
+        typedef T value_type;
+        template <typename U>
+        struct rebind {
+            typedef AlignedAllocator<U, Alignment> other;
+        };
+        AlignedAllocator() = default;
+        template <typename U>
+        AlignedAllocator(const AlignedAllocator<U, Alignment> &) {}
+        T *allocate(size_t count) {
+            return static_cast<T *>(allocateAligned(count * sizeof(T), Alignment));
+        }
+        void deallocate(T *pointer, size_t) {
+            freeAligned(pointer);
+        }
+    };
+
+    template <typename T, typename U, size_t Alignment>
+    bool operator==(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) {
+        return true;
+    }
+
+    template <typename T, typename U, size_t Alignment>
+    bool operator!=(const AlignedAllocator<T, Alignment> &, const AlignedAllocator<U, Alignment> &) {
+        return false;
+    }
+}
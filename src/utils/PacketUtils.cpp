@@ -0,0 +1,279 @@
+#include "PacketUtils.h"
+#include <cfloat>
+#include <cmath>
+#include "BVH.h"
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#if defined(__AVX2__)
+#define PACKET_WIDTH 8
+#elif defined(__SSE2__)
+#define PACKET_WIDTH 4
+#else
+#define PACKET_WIDTH 0 // no SIMD, callers fall back to tracing rays one at a time
+#endif
+
+namespace {
+#if PACKET_WIDTH > 0
+    /* SIMD lanes, one ray per lane. Comparisons give all-ones/all-zeros masks that select() and bits() consume */
+
+#if PACKET_WIDTH == 8
+    struct Float {
+        __m256 v;
+        Float() = default;
+        Float(__m256 value): v(value) {}
+        explicit Float(float value): v(_mm256_set1_ps(value)) {}
+    };
+    struct Int {
+        __m256i v;
+        Int() = default;
+        Int(__m256i value): v(value) {}
+        explicit Int(int32_t value): v(_mm256_set1_epi32(value)) {}
+    };
+    inline Float load(const float *values) { return _mm256_load_ps(values); }
+    inline Int load(const uint32_t *values) { return _mm256_loadu_si256((const __m256i *) values); }
+    inline void store(float *values, Float a) { _mm256_storeu_ps(values, a.v); }
+    inline void store(uint32_t *values, Int a) { _mm256_storeu_si256((__m256i *) values, a.v); }
+    inline Float operator+(Float a, Float b) { return _mm256_add_ps(a.v, b.v); }
+    inline Float operator-(Float a, Float b) { return _mm256_sub_ps(a.v, b.v); }
+    inline Float operator*(Float a, Float b) { return _mm256_mul_ps(a.v, b.v); }
+    inline Float operator/(Float a, Float b) { return _mm256_div_ps(a.v, b.v); }
+    inline Float operator<(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+    inline Float operator<=(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LE_OQ); }
+    inline Float operator>(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GT_OQ); }
+    inline Float operator>=(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_GE_OQ); }
+    inline Float operator==(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_EQ_OQ); }
+    inline Float operator!=(Float a, Float b) { return _mm256_cmp_ps(a.v, b.v, _CMP_NEQ_OQ); }
+    inline Float operator&(Float a, Float b) { return _mm256_and_ps(a.v, b.v); }
+    inline Float operator|(Float a, Float b) { return _mm256_or_ps(a.v, b.v); }
+    inline Float andNot(Float mask, Float a) { return _mm256_andnot_ps(mask.v, a.v); }
+    inline Float min(Float a, Float b) { return _mm256_min_ps(a.v, b.v); }
+    inline Float max(Float a, Float b) { return _mm256_max_ps(a.v, b.v); }
+    inline Float select(Float mask, Float a, Float b) { return _mm256_blendv_ps(b.v, a.v, mask.v); }
+    inline Int select(Float mask, Int a, Int b) { return _mm256_castps_si256(_mm256_blendv_ps(_mm256_castsi256_ps(b.v), _mm256_castsi256_ps(a.v), mask.v)); }
+    inline Float operator<(Int a, Int b) { return _mm256_castsi256_ps(_mm256_cmpgt_epi32(b.v, a.v)); }
+    inline Float operator!=(Int a, Int b) { return _mm256_castsi256_ps(_mm256_xor_si256(_mm256_cmpeq_epi32(a.v, b.v), _mm256_set1_epi32(-1))); }
+    inline Float laneMask(int count) { return Int(_mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7)) < Int(count); }
+    inline int bits(Float mask) { return _mm256_movemask_ps(mask.v); }
+#else
+    struct Float {
+        __m128 v;
+        Float() = default;
+        Float(__m128 value): v(value) {}
+        explicit Float(float value): v(_mm_set1_ps(value)) {}
+    };
+    struct Int {
+        __m128i v;
+        Int() = default;
+        Int(__m128i value): v(value) {}
+        explicit Int(int32_t value): v(_mm_set1_epi32(value)) {}
+    };
+    inline Float load(const float *values) { return _mm_load_ps(values); }
+    inline Int load(const uint32_t *values) { return _mm_loadu_si128((const __m128i *) values); }
+    inline void store(float *values, Float a) { _mm_storeu_ps(values, a.v); }
+    inline void store(uint32_t *values, Int a) { _mm_storeu_si128((__m128i *) values, a.v); }
+    inline Float operator+(Float a, Float b) { return _mm_add_ps(a.v, b.v); }
+    inline Float operator-(Float a, Float b) { return _mm_sub_ps(a.v, b.v); }
+    inline Float operator*(Float a, Float b) { return _mm_mul_ps(a.v, b.v); }
+    inline Float operator/(Float a, Float b) { return _mm_div_ps(a.v, b.v); }
+    inline Float operator<(Float a, Float b) { return _mm_cmplt_ps(a.v, b.v); }
+    inline Float operator<=(Float a, Float b) { return _mm_cmple_ps(a.v, b.v); }
+    inline Float operator>(Float a, Float b) { return _mm_cmpgt_ps(a.v, b.v); }
+    inline Float operator>=(Float a, Float b) { return _mm_cmpge_ps(a.v, b.v); }
+    inline Float operator==(Float a, Float b) { return _mm_cmpeq_ps(a.v, b.v); }
+    inline Float operator!=(Float a, Float b) { return _mm_cmpneq_ps(a.v, b.v); }
+    inline Float operator&(Float a, Float b) { return _mm_and_ps(a.v, b.v); }
+    inline Float operator|(Float a, Float b) { return _mm_or_ps(a.v, b.v); }
+    inline Float andNot(Float mask, Float a) { return _mm_andnot_ps(mask.v, a.v); }
+    inline Float min(Float a, Float b) { return _mm_min_ps(a.v, b.v); }
+    inline Float max(Float a, Float b) { return _mm_max_ps(a.v, b.v); }
+    inline Float select(Float mask, Float a, Float b) { return _mm_or_ps(_mm_and_ps(mask.v, a.v), _mm_andnot_ps(mask.v, b.v)); }
+    inline Int select(Float mask, Int a, Int b) { return _mm_castps_si128(select(mask, Float(_mm_castsi128_ps(a.v)), Float(_mm_castsi128_ps(b.v))).v); }
+    inline Float operator<(Int a, Int b) { return _mm_castsi128_ps(_mm_cmplt_epi32(a.v, b.v)); }
+    inline Float operator!=(Int a, Int b) { return _mm_castsi128_ps(_mm_xor_si128(_mm_cmpeq_epi32(a.v, b.v), _mm_set1_epi32(-1))); }
+    inline Float laneMask(int count) { return Int(_mm_setr_epi32(0, 1, 2, 3)) < Int(count); }
+    inline int bits(Float mask) { return _mm_movemask_ps(mask.v); }
+#endif
+
+    int countBits(int mask) {
+        int count = 0;
+        for (; mask; mask &= mask - 1) count++;
+        return count;
+    }
+
+    /// @brief PACKET_WIDTH rays in SoA form, plus the closest hit (or blocker) found so far for each
+    struct Packet {
+        Float origin[3];
+        Float direction[3];
+        Float inverseDirection[3];
+        Float active; // lanes still being traced
+        Float tMin;
+        Float t; // closest hit so far, or the furthest a blocker can be for shadow rays
+        Float u;
+        Float v;
+        Int index;
+        Int ignored; // triangle each lane should skip
+    };
+
+    void loadPacket(const Camera::RayBatch &rays, int first, int count, Packet &packet) {
+        const float *origins[3] = {rays.originX, rays.originY, rays.originZ};
+        const float *directions[3] = {rays.directionX, rays.directionY, rays.directionZ};
+        for (int i=0; i<3; i++) {
+            packet.origin[i] = load(origins[i] + first);
+            packet.direction[i] = load(directions[i] + first);
+            // zero components nudged so the slab test never divides by 0, as in the single ray path
+            alignas(32) float inverse[PACKET_WIDTH];
+            for (int lane=0; lane<PACKET_WIDTH; lane++) {
+                float direction = directions[i][first + lane];
+                if (std::fabs(direction) < 1e-20f) direction = std::copysign(1e-20f, direction);
+                inverse[lane] = 1.f / direction;
+            }
+            packet.inverseDirection[i] = load(inverse);
+        }
+        packet.active = laneMask(count - first);
+    }
+
+    /// @brief Slab test of every active lane against a node's box
+    Float intersectBounds(const BVH::Node &node, const Packet &packet, Float &tNear) {
+        Float tFar(FLT_MAX);
+        tNear = Float(-FLT_MAX);
+        for (int i=0; i<3; i++) {
+            Float t0 = (Float(node.min[i]) - packet.origin[i]) * packet.inverseDirection[i];
+            Float t1 = (Float(node.max[i]) - packet.origin[i]) * packet.inverseDirection[i];
+            tNear = max(tNear, min(t0, t1));
+            tFar = min(tFar, max(t0, t1));
+        }
+        return packet.active & (tNear <= tFar) & (tFar > Float(0.f)) & (tNear <= packet.t);
+    }
+
+    /// @brief Moller-Trumbore against one triangle for every lane, mirroring the single ray test
+    Float intersectTriangle(const BVH::Triangle &triangle, const Packet &packet, Float &t, Float &u, Float &v) {
+        Float e0[3] = {Float(triangle.e0.x), Float(triangle.e0.y), Float(triangle.e0.z)};
+        Float e1[3] = {Float(triangle.e1.x), Float(triangle.e1.y), Float(triangle.e1.z)};
+        const Float *d = packet.direction;
+        Float p[3] = {d[1] * e1[2] - e1[1] * d[2], d[2] * e1[0] - e1[2] * d[0], d[0] * e1[1] - e1[0] * d[1]};
+        Float determinant = e0[0] * p[0] + e0[1] * p[1] + e0[2] * p[2];
+        Float inverseDeterminant = Float(1.f) / determinant;
+        Float s[3] = {packet.origin[0] - Float(triangle.v0.x), packet.origin[1] - Float(triangle.v0.y), packet.origin[2] - Float(triangle.v0.z)};
+        u = (s[0] * p[0] + s[1] * p[1] + s[2] * p[2]) * inverseDeterminant;
+        Float q[3] = {s[1] * e0[2] - e0[1] * s[2], s[2] * e0[0] - e0[2] * s[0], s[0] * e0[1] - e0[0] * s[1]};
+        v = (d[0] * q[0] + d[1] * q[1] + d[2] * q[2]) * inverseDeterminant;
+        t = (e1[0] * q[0] + e1[1] * q[1] + e1[2] * q[2]) * inverseDeterminant;
+        Float hit = (determinant != Float(0.f)) & (u >= Float(0.f)) & (u <= Float(1.f)) & (v >= Float(0.f)) & (u + v <= Float(1.f));
+        Int index(triangle.index);
+        return hit & packet.active & (t > packet.tMin) & (index != packet.ignored);
+    }
+
+    /// @brief Walks the BVH once for the whole packet. Closest hit keeps shrinking each lane's t,
+    /// any hit retires a lane as soon as it finds a blocker and stops once every lane is retired
+    template<bool anyHit>
+    void traverse(const BVH &bvh, Packet &packet) {
+        if (bvh.nodes.empty()) return;
+        Float tNear;
+        if (!bits(intersectBounds(bvh.nodes[0], packet, tNear))) return;
+        uint32_t stack[BVH::maxDepth + 2];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const BVH::Node &node = bvh.nodes[stack[--stackSize]];
+            if (node.count > 0) {
+                for (uint32_t i=node.leftFirst; i<node.leftFirst+node.count; i++) {
+                    const BVH::Triangle &triangle = bvh.triangles[i];
+                    Float t, u, v;
+                    Float hit = intersectTriangle(triangle, packet, t, u, v);
+                    if (anyHit) {
+                        hit = hit & (t < packet.t);
+                        if (!bits(hit)) continue;
+                        packet.t = select(hit, t, packet.t);
+                        packet.index = select(hit, Int(triangle.index), packet.index);
+                        packet.active = andNot(hit, packet.active);
+                        if (!bits(packet.active)) return;
+                    } else {
+                        Int index(triangle.index);
+                        hit = hit & ((t < packet.t) | ((t == packet.t) & (index < packet.index))); // ties go to the lowest index
+                        if (!bits(hit)) continue;
+                        packet.t = select(hit, t, packet.t);
+                        packet.u = select(hit, u, packet.u);
+                        packet.v = select(hit, v, packet.v);
+                        packet.index = select(hit, index, packet.index);
+                    }
+                }
+                continue;
+            }
+            uint32_t near = node.leftFirst;
+            uint32_t far = node.leftFirst + 1;
+            Float tNearLeft, tNearRight;
+            int hitLeft = bits(intersectBounds(bvh.nodes[near], packet, tNearLeft));
+            int hitRight = bits(intersectBounds(bvh.nodes[far], packet, tNearRight));
+            if (hitLeft && hitRight) {
+                // visit first whichever child is nearer for most of the lanes that hit both
+                int both = hitLeft & hitRight;
+                if (countBits(bits(tNearRight < tNearLeft) & both) * 2 > countBits(both)) std::swap(near, far);
+                stack[stackSize++] = far;
+                stack[stackSize++] = near;
+            } else if (hitLeft) {
+                stack[stackSize++] = near;
+            } else if (hitRight) {
+                stack[stackSize++] = far;
+            }
+        }
+    }
+#endif
+}
+
+namespace PacketUtils {
+    /// @brief Number of rays traced together, 0 if this build has no SIMD support and rays must be traced one by one
+    int packetWidth() {
+        return PACKET_WIDTH;
+    }
+
+    /// @brief Closest hit for the first count rays of a batch, traced PACKET_WIDTH at a time
+    void findClosestTriangles(const BVH &bvh, const Camera::RayBatch &rays, int count, Hits &hits) {
+#if PACKET_WIDTH > 0
+        for (int first=0; first<count; first+=PACKET_WIDTH) {
+            Packet packet;
+            loadPacket(rays, first, count, packet);
+            packet.tMin = Float(0.f);
+            packet.t = Float(FLT_MAX);
+            packet.u = Float(0.f);
+            packet.v = Float(0.f);
+            packet.index = Int(0);
+            packet.ignored = Int(-1);
+            traverse<false>(bvh, packet);
+            store(hits.t + first, packet.t);
+            store(hits.u + first, packet.u);
+            store(hits.v + first, packet.v);
+            store(hits.index + first, packet.index);
+        }
+#endif
+    }
+
+    /// @brief Any-hit query for the first count rays of a batch, blockerDistances[i] is -1 if nothing lies between tMin and tMax[i]
+    void findBlockers(const BVH &bvh, const Camera::RayBatch &rays, int count, const float *tMax, const uint32_t *ignored, float *blockerDistances) {
+#if PACKET_WIDTH > 0
+        const float epsilon = 1e-4f;
+        for (int first=0; first<count; first+=PACKET_WIDTH) {
+            Packet packet;
+            loadPacket(rays, first, count, packet);
+            alignas(32) float limits[PACKET_WIDTH];
+            alignas(32) uint32_t skipped[PACKET_WIDTH];
+            for (int lane=0; lane<PACKET_WIDTH; lane++) {
+                limits[lane] = first + lane < count ? tMax[first + lane] : 0.f;
+                skipped[lane] = first + lane < count ? ignored[first + lane] : 0;
+            }
+            packet.tMin = Float(epsilon);
+            packet.t = load(limits);
+            packet.ignored = load(skipped);
+            packet.index = Int(0);
+            packet.active = packet.active & (packet.t > packet.tMin);
+            Float unblocked = packet.active;
+            traverse<true>(bvh, packet);
+            Float blocked = andNot(packet.active, unblocked);
+            alignas(32) float distances[PACKET_WIDTH];
+            store(distances, select(blocked, packet.t, Float(-1.f)));
+            for (int lane=0; lane<PACKET_WIDTH && first + lane<count; lane++) blockerDistances[first + lane] = distances[lane];
+        }
+#endif
+    }
+}
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <cstdint>
+#include "Camera.h"
+
+class BVH;
+
+namespace PacketUtils {
+    const int maxPacketWidth = Camera::rayBatchSize;
+    /// @brief Closest hit for each ray of a batch, t is FLT_MAX for rays that hit nothing
+    struct Hits {
+        float t[maxPacketWidth];
+        float u[maxPacketWidth];
+        float v[maxPacketWidth];
+        uint32_t index[maxPacketWidth];
+    };
+    int packetWidth();
+    void findClosestTriangles(const BVH &bvh, const Camera::RayBatch &rays, int count, Hits &hits);
+    void findBlockers(const BVH &bvh, const Camera::RayBatch &rays, int count, const float *tMax, const uint32_t *ignored, float *blockerDistances);
+}
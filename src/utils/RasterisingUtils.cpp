@@ -1,49 +1,266 @@
 #include "RasterisingUtils.h"
 #include "Scene.h"
-#include <ModelTriangle.h>
 #include <CanvasTriangle.h>
 #include <CanvasPoint.h>
 #include <glm/glm.hpp>
 #include "TriangleUtils.h"
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <cmath>
 
 namespace {
-    /// @brief Converts a point in world space to a canvas point
-    CanvasPoint worldToCanvas(Scene &scene, glm::vec3 vertex) {
+    const float guardBand = 4.f; // triangles reaching further than this many half screens from the centre are clipped, nearer ones only have their bounds clamped
+    const int maxClippedVertices = 8; // a triangle clipped by the near plane and four guard band planes
+
+    /// @brief Converts a point in clip space to a canvas point
+    CanvasPoint clipToCanvas(const Scene &scene, glm::vec4 clipPos) {
         float n = scene.camera.near;
         float f = scene.camera.far;
-        glm::vec4 clipPos = scene.camera.vp * glm::vec4(vertex, 1.f);
         glm::vec3 ndsPos(clipPos.x/clipPos.w, clipPos.y/clipPos.w, clipPos.z/clipPos.w); // normalised device space
         CanvasPoint screenPos(scene.width/2 * (ndsPos.x + 1), scene.height/2 * (ndsPos.y + 1), ndsPos.z * (f - n)/2 + (f + n)/2);
         return screenPos;
     }
 
-    /// @brief Takes triangles in world space and makes them into triangles with canvas points
-    CanvasTriangle makeCanvasTriangle(Scene &scene, ModelTriangle triangle) {
-        CanvasTriangle canvasTriangle;
-        for (int i=0; i<3; i++) {
-            glm::vec3 vertex = triangle.vertices[i];
-            CanvasPoint canvasIntersection = worldToCanvas(scene, vertex);
-            canvasTriangle.vertices[i] = canvasIntersection;
+    /// @brief Bit for each clipping plane the point is outside of: the near plane, then the sides of a box extent half screens across
+    int outcode(glm::vec4 point, float extent) {
+        int code = 0;
+        if (point.z < -point.w) code |= 1;
+        if (point.x < -extent * point.w) code |= 2;
+        if (point.x > extent * point.w) code |= 4;
+        if (point.y < -extent * point.w) code |= 8;
+        if (point.y > extent * point.w) code |= 16;
+        return code;
+    }
+
+    /// @brief Clips the polygon against the near plane and the guard band in clip space (Sutherland-Hodgman), returning how many vertices are left
+    int clipPolygon(glm::vec4 *polygon, int count) {
+        const glm::vec4 planes[5] = {
+                {0.f, 0.f, 1.f, 1.f}, // z >= -w
+                {1.f, 0.f, 0.f, guardBand}, // x >= -guardBand * w
+                {-1.f, 0.f, 0.f, guardBand},
+                {0.f, 1.f, 0.f, guardBand},
+                {0.f, -1.f, 0.f, guardBand}
+        };
+        glm::vec4 clipped[maxClippedVertices];
+        for (const glm::vec4 &plane : planes) {
+            int clippedCount = 0;
+            for (int i=0; i<count; i++) {
+                glm::vec4 from = polygon[i];
+                glm::vec4 to = polygon[(i + 1) % count];
+                float fromDistance = glm::dot(plane, from);
+                float toDistance = glm::dot(plane, to);
+                if (fromDistance >= 0.f) clipped[clippedCount++] = from;
+                if ((fromDistance >= 0.f) != (toDistance >= 0.f)) clipped[clippedCount++] = from + (to - from) * (fromDistance / (fromDistance - toDistance));
+            }
+            count = clippedCount;
+            std::copy(clipped, clipped + count, polygon);
+            if (count < 3) return 0;
+        }
+        return count;
+    }
+
+    /// @brief Transforms every vertex to clip space once, rather than once for each triangle that uses it
+    void transformVertices(Scene &scene, std::vector<glm::vec4> &clipVertices) {
+        const size_t blockSize = 4096;
+        size_t vertexCount = scene.geometry->vertexCount();
+        clipVertices.resize(vertexCount);
+        scene.threadPool->parallelFor((vertexCount + blockSize - 1) / blockSize, [&](size_t block) {
+            size_t end = std::min(vertexCount, (block + 1) * blockSize);
+            for (size_t i=block*blockSize; i<end; i++) clipVertices[i] = scene.camera.vp * glm::vec4(scene.geometry->positions.get(i), 1.f);
+        });
+    }
+
+    /// @brief Smallest depth in any block of the tile, 0 until every block has been drawn in
+    float farthestDepth(RenderTarget &target, const TriangleUtils::PixelBounds &tile) {
+        const int blockSize = RenderTarget::depthBlockSize;
+        float farthest = INFINITY;
+        for (int blockY=tile.y0/blockSize; blockY<=(tile.y1-1)/blockSize; blockY++) {
+            for (int blockX=tile.x0/blockSize; blockX<=(tile.x1-1)/blockSize; blockX++) farthest = std::min(farthest, target.getFarthestDepth(blockX, blockY));
+        }
+        return farthest;
+    }
+
+    /// @brief Sets up the canvas triangle and appends it to the list of every tile its pixels can fall in
+    void binTriangle(const Scene &scene, RasterisingUtils::Bins &bins, size_t batch, uint32_t triangle, const CanvasTriangle &canvasTriangle) {
+        std::vector<RasterisingUtils::Bins::Triangle> &setups = bins.setups[batch];
+        RasterisingUtils::Bins::Triangle binned;
+        binned.triangle = triangle;
+        if (!TriangleUtils::setupTriangle(canvasTriangle, (int) scene.target.width, (int) scene.target.height, binned.setup)) return;
+        if (!bins.occlusionCulling) binned.setup.nearestDepth = INFINITY; // never behind anything
+        const TriangleUtils::PixelBounds &bounds = binned.setup.bounds;
+        std::vector<uint32_t> *tileLists = &bins.triangles[batch * bins.tilesX * bins.tilesY];
+        for (int tileY=bounds.y0/RasterisingUtils::tileSize; tileY<=(bounds.y1-1)/RasterisingUtils::tileSize; tileY++) {
+            for (int tileX=bounds.x0/RasterisingUtils::tileSize; tileX<=(bounds.x1-1)/RasterisingUtils::tileSize; tileX++) {
+                tileLists[tileY * bins.tilesX + tileX].push_back((uint32_t) setups.size());
+            }
+        }
+        setups.push_back(binned);
+    }
+
+    /// @brief Clips the edge to the near plane in clip space, then draws what is left of it on the canvas, which clips it again to the canvas
+    void drawEdge(Scene &scene, glm::vec4 from, glm::vec4 to, const Colour &colour) {
+        float fromDistance = from.z + from.w; // in front of the near plane z = -w when positive
+        float toDistance = to.z + to.w;
+        if (fromDistance < 0.f && toDistance < 0.f) return;
+        if (fromDistance < 0.f) from += (to - from) * (fromDistance / (fromDistance - toDistance));
+        else if (toDistance < 0.f) to += (from - to) * (toDistance / (toDistance - fromDistance));
+        if (scene.smoothLines) {
+            TriangleUtils::drawSmoothLine(scene.target, clipToCanvas(scene, from), clipToCanvas(scene, to), colour);
+        } else {
+            TriangleUtils::drawLine(scene.target, clipToCanvas(scene, from), clipToCanvas(scene, to), TriangleUtils::packColour(colour));
+        }
+    }
+
+    /// @brief Bins triangles [begin, end) of the visible objects, counted through them in order. Triangles facing away from the camera are dropped
+    /// if their material asks, as are ones wholly off screen or behind the near plane. Ones that cross the near plane or reach past the guard band
+    /// are clipped first, so every corner that reaches setup is in front of the camera at a sane canvas position
+    void binTriangles(const Scene &scene, RasterisingUtils::Bins &bins, size_t batch, size_t begin, size_t end) {
+        bins.setups[batch].clear();
+        size_t objectEnd = 0;
+        for (const RasterisingUtils::VisibleObject &visible : scene.visibleObjects) {
+            const Geometry::Object &object = scene.geometry->objects[visible.object];
+            size_t objectBegin = objectEnd;
+            objectEnd += object.count;
+            if (objectEnd <= begin) continue;
+            if (objectBegin >= end) break;
+            bool backFaceCulling = scene.materials[scene.geometry->materialIds[object.first]].backFaceCulling;
+            size_t last = object.first + std::min(end, objectEnd) - objectBegin;
+            for (size_t triangle=object.first+std::max(begin, objectBegin)-objectBegin; triangle<last; triangle++) {
+                if (backFaceCulling && glm::dot(scene.geometry->surfaceNormals.get(triangle), scene.geometry->vertex(triangle, 0) - scene.camera.position) >= 0.f) continue;
+                const uint32_t *indices = &scene.geometry->indices[3 * triangle];
+                glm::vec4 polygon[maxClippedVertices];
+                int screenCodes = ~0;
+                int guardCodes = 0;
+                for (int i=0; i<3; i++) {
+                    polygon[i] = bins.clipVertices[indices[i]];
+                    screenCodes &= outcode(polygon[i], 1.f);
+                    guardCodes |= outcode(polygon[i], guardBand);
+                }
+                if (screenCodes != 0) continue; // every corner is outside the same plane
+                if (guardCodes == 0) {
+                    binTriangle(scene, bins, batch, (uint32_t) triangle, {clipToCanvas(scene, polygon[0]), clipToCanvas(scene, polygon[1]), clipToCanvas(scene, polygon[2])});
+                    continue;
+                }
+                int count = clipPolygon(polygon, 3);
+                CanvasPoint first = clipToCanvas(scene, polygon[0]);
+                for (int i=1; i+1<count; i++) {
+                    binTriangle(scene, bins, batch, (uint32_t) triangle, {first, clipToCanvas(scene, polygon[i]), clipToCanvas(scene, polygon[i + 1])});
+                }
+            }
         }
-        return canvasTriangle;
     }
 }
 
 namespace RasterisingUtils {
-    /// @brief Default rasterised
-    void drawFilled(Scene &scene) {
-        scene.camera.resetDepthBuffer();
-        for (const auto &triangle : scene.triangles) {
-            CanvasTriangle canvasTriangle = makeCanvasTriangle(scene, triangle);
-            TriangleUtils::drawFilledTriangle(scene, canvasTriangle, triangle.colour);
+    /// @brief Lists the objects whose boxes are not wholly outside one side of the view frustum, with the pixels each can cover,
+    /// so the rasteriser only bins their triangles and the ray tracer only traces rays that can hit them
+    void cullObjects(Scene &scene) {
+        int width = (int) scene.target.width;
+        int height = (int) scene.target.height;
+        scene.visibleObjects.clear();
+        for (uint32_t i=0; i<scene.geometry->objects.size(); i++) {
+            const Geometry::Object &object = scene.geometry->objects[i];
+            if (!scene.frustumCulling) {
+                scene.visibleObjects.push_back({i, {0, 0, width, height}});
+                continue;
+            }
+            int screenCodes = ~0;
+            bool behindCamera = false; // the box reaches behind the eye, so its corners do not bound where it lands on screen
+            glm::vec2 canvasMin(FLT_MAX);
+            glm::vec2 canvasMax(-FLT_MAX);
+            for (int corner=0; corner<8; corner++) {
+                glm::vec3 point(corner & 1 ? object.max.x : object.min.x, corner & 2 ? object.max.y : object.min.y, corner & 4 ? object.max.z : object.min.z);
+                glm::vec4 clipPos = scene.camera.vp * glm::vec4(point, 1.f);
+                screenCodes &= outcode(clipPos, 1.f);
+                if (clipPos.w <= 0.f) {
+                    behindCamera = true;
+                    continue;
+                }
+                CanvasPoint canvasPos = clipToCanvas(scene, clipPos);
+                canvasMin = glm::min(canvasMin, glm::vec2(canvasPos.x, canvasPos.y));
+                canvasMax = glm::max(canvasMax, glm::vec2(canvasPos.x, canvasPos.y));
+            }
+            if (screenCodes != 0) continue; // every corner is outside the same plane
+            VisibleObject visible = {i, {0, 0, width, height}};
+            if (!behindCamera) {
+                // a pixel either side, clamped before converting so corners near the eye do not overflow
+                visible.bounds.x0 = (int) std::floor(glm::clamp(canvasMin.x - 1.f, 0.f, (float) width));
+                visible.bounds.y0 = (int) std::floor(glm::clamp(canvasMin.y - 1.f, 0.f, (float) height));
+                visible.bounds.x1 = (int) std::ceil(glm::clamp(canvasMax.x + 1.f, 0.f, (float) width));
+                visible.bounds.y1 = (int) std::ceil(glm::clamp(canvasMax.y + 1.f, 0.f, (float) height));
+                if (visible.bounds.x0 >= visible.bounds.x1 || visible.bounds.y0 >= visible.bounds.y1) continue;
+            }
+            scene.visibleObjects.push_back(visible);
         }
     }
 
-    /// @brief Wire frame
+    /// @brief Default rasterised. Objects outside the view frustum are dropped whole. Sort middle: vertices are transformed and triangles binned into screen tiles in parallel, then each tile is filled
+    /// by one thread. Tiles are whole depth blocks, so no two threads share one. A tile visits its triangles in model order, so every pixel ends up as it would drawing serially.
+    /// Triangles wholly behind what a tile or block already holds are rejected without testing their pixels
+    void drawFilled(Scene &scene) {
+        Bins &bins = scene.rasterBins;
+        scene.target.clearDepth();
+        cullObjects(scene);
+        transformVertices(scene, bins.clipVertices);
+        bins.tilesX = ((int) scene.target.width + tileSize - 1) / tileSize;
+        bins.tilesY = ((int) scene.target.height + tileSize - 1) / tileSize;
+        bins.batchCount = scene.threadPool->size();
+        size_t tileCount = bins.tilesX * bins.tilesY;
+        bins.triangles.resize(bins.batchCount * tileCount);
+        for (std::vector<uint32_t> &tileList : bins.triangles) tileList.clear();
+        size_t triangleCount = 0;
+        for (const VisibleObject &visible : scene.visibleObjects) triangleCount += scene.geometry->objects[visible.object].count;
+        bins.setups.resize(bins.batchCount);
+        scene.threadPool->parallelFor(bins.batchCount, [&](size_t batch) {
+            binTriangles(scene, bins, batch, triangleCount * batch / bins.batchCount, triangleCount * (batch + 1) / bins.batchCount);
+        });
+        std::atomic<size_t> culledTriangles(0);
+        std::atomic<size_t> skippedPixelTests(0);
+        scene.threadPool->parallelFor(tileCount, [&](size_t tile) {
+            TriangleUtils::PixelBounds bounds;
+            bounds.x0 = (int) (tile % bins.tilesX) * tileSize;
+            bounds.y0 = (int) (tile / bins.tilesX) * tileSize;
+            bounds.x1 = std::min(bounds.x0 + tileSize, (int) scene.target.width);
+            bounds.y1 = std::min(bounds.y0 + tileSize, (int) scene.target.height);
+            TriangleUtils::CullStats tileStats;
+            float tileFarthest = 0.f; // smallest depth in the tile, the top level of the hierarchical depth test
+            for (int batch=0; batch<bins.batchCount; batch++) {
+                for (uint32_t binned : bins.triangles[batch * tileCount + tile]) {
+                    const TriangleUtils::TriangleSetup &setup = bins.setups[batch][binned].setup;
+                    uint32_t triangle = bins.setups[batch][binned].triangle;
+                    if (setup.nearestDepth < tileFarthest) {
+                        tileStats.culledTriangles++;
+                        tileStats.skippedPixelTests += (std::min(setup.bounds.x1, bounds.x1) - std::max(setup.bounds.x0, bounds.x0)) * (std::min(setup.bounds.y1, bounds.y1) - std::max(setup.bounds.y0, bounds.y0));
+                        continue;
+                    }
+                    uint32_t colour = TriangleUtils::packColour(scene.materials[scene.geometry->materialIds[triangle]].diffuse);
+                    if (!TriangleUtils::drawFilledTriangle(scene.target, setup, colour, bounds, tileStats)) continue;
+                    tileFarthest = farthestDepth(scene.target, bounds);
+                }
+            }
+            culledTriangles += tileStats.culledTriangles;
+            skippedPixelTests += tileStats.skippedPixelTests;
+        });
+        scene.stats.culledTriangles = culledTriangles;
+        scene.stats.skippedPixelTests = skippedPixelTests;
+    }
+
+    /// @brief Wire frame. Objects outside the view frustum are dropped whole, as are triangles wholly off screen, and the edges of the rest are clipped before they are stepped
     void drawStroked(Scene &scene) {
-        for (const auto &triangle : scene.triangles) {
-            CanvasTriangle canvasTriangle = makeCanvasTriangle(scene, triangle);
-            TriangleUtils::drawStrokedTriangle(scene, canvasTriangle);
+        Colour colour(255, 255, 255);
+        std::vector<glm::vec4> &clipVertices = scene.rasterBins.clipVertices;
+        cullObjects(scene);
+        transformVertices(scene, clipVertices);
+        for (const VisibleObject &visible : scene.visibleObjects) {
+            const Geometry::Object &object = scene.geometry->objects[visible.object];
+            for (size_t triangle=object.first; triangle<object.first+object.count; triangle++) {
+                const uint32_t *indices = &scene.geometry->indices[3 * triangle];
+                int screenCodes = ~0;
+                for (int i=0; i<3; i++) screenCodes &= outcode(clipVertices[indices[i]], 1.f);
+                if (screenCodes != 0) continue; // every corner is outside the same plane
+                for (int i=0; i<3; i++) drawEdge(scene, clipVertices[indices[i]], clipVertices[indices[(i + 1) % 3]], colour);
+            }
         }
     }
 }
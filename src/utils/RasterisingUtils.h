@@ -2,10 +2,34 @@
 
 #include <glm/glm.hpp>
 #include <CanvasPoint.h>
+#include "TriangleUtils.h"
+#include <cstdint>
+#include <vector>
 
 class Scene; // pre-declare to avoid circular dependency
 
 namespace RasterisingUtils {
+    const int tileSize = 32; // pixels along each side of a screen tile, a multiple of RenderTarget::depthBlockSize
+    /// @brief An object of the geometry at least partly inside the view frustum, and the pixels it can cover
+    struct VisibleObject {
+        uint32_t object; // index into Geometry::objects
+        TriangleUtils::PixelBounds bounds;
+    };
+    /// @brief Per frame working memory of drawFilled (drawStroked only uses clipVertices), kept by the scene so it only allocates while it grows
+    struct Bins {
+        struct Triangle {
+            TriangleUtils::TriangleSetup setup;
+            uint32_t triangle; // in the geometry, a triangle the near plane or guard band cut up leaves several
+        };
+        std::vector<glm::vec4> clipVertices; // every vertex of the geometry in clip space
+        std::vector<std::vector<Triangle>> setups; // for each batch, its triangles that survived clipping in model order
+        std::vector<std::vector<uint32_t>> triangles; // indices into the batch's setups of the triangles overlapping each tile, one list per tile per batch
+        int tilesX = 0;
+        int tilesY = 0;
+        int batchCount = 0;
+        bool occlusionCulling = true; // hierarchical depth test, only worth turning off to measure what it saves
+    };
+    void cullObjects(Scene &scene);
     void drawFilled(Scene &scene);
     void drawStroked(Scene &scene);
-}
\ No newline at end of file
+}
@@ -5,134 +5,278 @@
 #include "Scene.h"
 #include "TriangleUtils.h"
 #include "LightingUtils.h"
+#include "BVH.h"
+#include "PacketUtils.h"
+#include "RasterisingUtils.h"
 #include <cmath>
+#include <algorithm>
 
 namespace {
-    /// @brief Gets the absolute distance along ray (t), and proportional distances along triangle edges (u, v)
-    glm::vec3 calculateRawIntersection(glm::vec3 from, ModelTriangle triangle, glm::mat3 DEMatrix) {
-        glm::vec3 SPVector = from - triangle.vertices[0];
-        glm::vec3 rawIntersection = glm::inverse(DEMatrix) * SPVector;
-        return rawIntersection;
+    /// @brief Closest intersection found so far while traversing the BVH
+    struct Hit {
+        float t; // distance along ray
+        float u; // proportional distance along e0
+        float v; // proportional distance along e1
+        uint32_t index;
+    };
+
+    /// @brief Moller-Trumbore test, solves for distance along ray (t) and along triangle edges (u, v) without inverting a matrix
+    bool intersectTriangle(const BVH::Triangle &triangle, const Ray &ray, float &t, float &u, float &v) {
+        glm::vec3 p = glm::cross(ray.direction, triangle.e1);
+        float determinant = glm::dot(triangle.e0, p);
+        if (determinant == 0.f) return false; // ray is parallel to the triangle
+        float inverseDeterminant = 1.f / determinant;
+        glm::vec3 s = ray.origin - triangle.v0;
+        u = glm::dot(s, p) * inverseDeterminant;
+        if (u < 0.f || u > 1.f) return false;
+        glm::vec3 q = glm::cross(s, triangle.e0);
+        v = glm::dot(ray.direction, q) * inverseDeterminant;
+        if (v < 0.f || u + v > 1.f) return false;
+        t = glm::dot(triangle.e1, q) * inverseDeterminant;
+        return t > 0.f;
     }
 
-    /// @brief Ensures the distances are on the triangle edges, and the distance along the ray is positive
-    bool validateRawIntersection(glm::vec3 rawIntersection) {
-        float t = rawIntersection.x;
-        float u = rawIntersection.y;
-        float v = rawIntersection.z;
-        if (u >= 0.0 && u <= 1.0 && v >= 0.0 && v <= 1.0 && u + v <= 1.0 && t > 0) {
-            return true;
+    /// @brief Tests a single triangle and keeps it if it is hit before the closest intersection so far
+    void updateClosestHit(const BVH::Triangle &triangle, const Ray &ray, bool mirror, int k, Hit &closestHit) {
+        float t, u, v;
+        if (!intersectTriangle(triangle, ray, t, u, v)) return;
+        if (t > closestHit.t) return; // something closer already exists
+        if (t == closestHit.t && triangle.index > closestHit.index) return; // ties go to the lowest index
+        if (mirror && triangle.index == (uint32_t) k) return; // same triangle we are reflecting from
+        closestHit = {t, u, v, triangle.index};
+    }
+
+    /// @brief Reciprocal of the ray direction, with zero components nudged so the slab test never divides by 0
+    glm::vec3 calculateInverseDirection(glm::vec3 direction) {
+        for (int i=0; i<3; i++) {
+            if (std::fabs(direction[i]) < 1e-20f) direction[i] = std::copysign(1e-20f, direction[i]);
         }
-        return false;
+        return 1.f / direction;
     }
 
-    /// @brief Finds the relevant 3D point on the intersecting triangle
-    glm::vec3 calculateIntersection(glm::mat3 DEMatrix, ModelTriangle triangle, glm::vec3 rawIntersection) {
-        glm::vec3 e0 = DEMatrix[1];
-        glm::vec3 e1 = DEMatrix[2];
-        glm::vec3 intersectionPoint = triangle.vertices[0] + rawIntersection.y * e0 + rawIntersection.z * e1;
-        return intersectionPoint;
+    /// @brief Slab test between a ray and a node's box, giving the distance along the ray at which it enters the box
+    bool intersectBounds(const BVH::Node &node, glm::vec3 origin, glm::vec3 inverseDirection, float tMax, float &tNear) {
+        glm::vec3 t0 = (node.min - origin) * inverseDirection;
+        glm::vec3 t1 = (node.max - origin) * inverseDirection;
+        glm::vec3 tSmaller = glm::min(t0, t1);
+        glm::vec3 tBigger = glm::max(t0, t1);
+        tNear = glm::max(glm::max(tSmaller.x, tSmaller.y), tSmaller.z);
+        float tFar = glm::min(glm::min(tBigger.x, tBigger.y), tBigger.z);
+        return tNear <= tFar && tFar > 0 && tNear <= tMax;
+    }
+
+    /// @brief Walks the BVH front to back, calling visit on each triangle in every leaf the ray enters before tMax.
+    /// visit may shrink tMax to cull boxes behind a hit, and returns true to stop the walk
+    template<typename Visit>
+    void traverse(const BVH &bvh, const Ray &ray, const float &tMax, Visit visit) {
+        if (bvh.nodes.empty()) return;
+        glm::vec3 inverseDirection = calculateInverseDirection(ray.direction);
+        float tNear;
+        if (!intersectBounds(bvh.nodes[0], ray.origin, inverseDirection, tMax, tNear)) return;
+        uint32_t stack[BVH::maxDepth + 2];
+        int stackSize = 0;
+        stack[stackSize++] = 0;
+        while (stackSize > 0) {
+            const BVH::Node &node = bvh.nodes[stack[--stackSize]];
+            if (node.count > 0) {
+                for (uint32_t i=node.leftFirst; i<node.leftFirst+node.count; i++) {
+                    if (visit(bvh.triangles[i])) return;
+                }
+                continue;
+            }
+            // visit the nearer child first so the far one can be culled by the closest hit so far
+            uint32_t near = node.leftFirst;
+            uint32_t far = node.leftFirst + 1;
+            float tNearLeft, tNearRight;
+            bool hitLeft = intersectBounds(bvh.nodes[near], ray.origin, inverseDirection, tMax, tNearLeft);
+            bool hitRight = intersectBounds(bvh.nodes[far], ray.origin, inverseDirection, tMax, tNearRight);
+            if (hitLeft && hitRight) {
+                if (tNearRight < tNearLeft) std::swap(near, far);
+                stack[stackSize++] = far;
+                stack[stackSize++] = near;
+            } else if (hitLeft) {
+                stack[stackSize++] = near;
+            } else if (hitRight) {
+                stack[stackSize++] = far;
+            }
+        }
     }
 
-    glm::mat3 calculateDEMatrix(ModelTriangle triangle, glm::vec3 rayDirection) {
-        glm::vec3 e0 = triangle.vertices[1] - triangle.vertices[0];
-        glm::vec3 e1 = triangle.vertices[2] - triangle.vertices[0];
-        glm::mat3 DEMatrix(-rayDirection, e0, e1);
-        return DEMatrix;
+    /// @brief Any-hit query, stops at the first triangle (other than ignored) hit between tMin and tMax
+    bool findBlocker(const BVH &bvh, const Ray &ray, float tMin, float tMax, uint32_t ignored, float &blockerDistance) {
+        bool blocked = false;
+        traverse(bvh, ray, tMax, [&](const BVH::Triangle &triangle) {
+            float t, u, v;
+            if (triangle.index == ignored || !intersectTriangle(triangle, ray, t, u, v)) return false;
+            if (t <= tMin || t >= tMax) return false;
+            blockerDistance = t;
+            blocked = true;
+            return true;
+        });
+        return blocked;
     }
 
-    /// @brief Converts a canvas point from ([0, width], [0, height]) to ([-1, 1], [-1, 1])
-    glm::vec2 normaliseCanvasPoint(Scene &scene, CanvasPoint canvasPoint) {
-        float normalisedX = canvasPoint.x * 2 / scene.width - 1;
-        float normalisedY = canvasPoint.y * 2 / scene.height - 1;
-        return {normalisedX, normalisedY};
+    /// @brief Turns the closest hit found by traversal into an intersection record
+    RayTriangleIntersection makeIntersection(const Geometry &geometry, const Hit &closestHit) {
+        glm::vec3 v0 = geometry.vertex(closestHit.index, 0);
+        glm::vec3 e0 = geometry.vertex(closestHit.index, 1) - v0;
+        glm::vec3 e1 = geometry.vertex(closestHit.index, 2) - v0;
+        glm::vec3 intersectionPoint = v0 + closestHit.u * e0 + closestHit.v * e1;
+        return {intersectionPoint, closestHit.t, closestHit.u, closestHit.v, closestHit.index, geometry.materialIds[closestHit.index]};
     }
 
-    /// @brief Gets the ray from origin camera (near plane viewpoint) to canvas point in 3D
-    Ray calculateRayFromCamera(Scene &scene, CanvasPoint canvasPoint) {
-        float n = scene.camera.near;
-        float f = scene.camera.far;
-        glm::vec2 normalisedCanvasPoint = normaliseCanvasPoint(scene, canvasPoint);
-        glm::vec4 nearPos(normalisedCanvasPoint.x, normalisedCanvasPoint.y, -1.0, 1.0); // canvas point on near plane
-        glm::vec4 origin(glm::inverse(scene.camera.vp) * nearPos * n); // adjust near pos to world
-        glm::vec4 farPos(normalisedCanvasPoint.x * (f - n), normalisedCanvasPoint.y * (f - n), f + n, f - n); // canvas point on far plane
-        glm::vec4 direction(glm::normalize(glm::inverse(scene.camera.vp) * farPos)); // adjust far pos to world and normalise
-        return {glm::vec3(origin), glm::vec3(direction)};
+    /// @brief Finds what the first count rays of a batch hit, as SIMD packets when the build supports them
+    void findClosestTriangles(Scene &scene, const Camera::RayBatch &batch, int count, RayTriangleIntersection *closestTriangles) {
+        if (PacketUtils::packetWidth() == 0) {
+            for (int i=0; i<count; i++) closestTriangles[i] = RayTracingUtils::findClosestTriangle(scene, batch.ray(i), false, -1);
+            return;
+        }
+        PacketUtils::Hits hits;
+        PacketUtils::findClosestTriangles(*scene.bvh, batch, count, hits);
+        for (int i=0; i<count; i++) {
+            if (hits.t[i] == FLT_MAX) {
+                closestTriangles[i].distanceFromCamera = FLT_MAX;
+                continue;
+            }
+            closestTriangles[i] = makeIntersection(*scene.geometry, {hits.t[i], hits.u[i], hits.v[i], hits.index[i]});
+        }
+    }
+
+    /// @brief Traces hard shadow rays from each hit point toward the light as packets, see canSeeLight for the result
+    void findBlockers(Scene &scene, RayTriangleIntersection *closestTriangles, int count, float *blockerDistances) {
+        Camera::RayBatch shadowRays;
+        float lightDistances[Camera::rayBatchSize];
+        uint32_t ignored[Camera::rayBatchSize];
+        for (int i=0; i<count; i++) {
+            glm::vec3 origin = closestTriangles[i].intersectionPoint;
+            glm::vec3 toLight = scene.light.position - origin;
+            lightDistances[i] = glm::length(toLight);
+            if (closestTriangles[i].distanceFromCamera == FLT_MAX) {
+                origin = scene.light.position;
+                lightDistances[i] = 0.f; // nothing to shade, so nothing to trace
+            }
+            glm::vec3 direction = lightDistances[i] > 0.f ? toLight / lightDistances[i] : glm::vec3(0.f, 1.f, 0.f);
+            shadowRays.originX[i] = origin.x;
+            shadowRays.originY[i] = origin.y;
+            shadowRays.originZ[i] = origin.z;
+            shadowRays.directionX[i] = direction.x;
+            shadowRays.directionY[i] = direction.y;
+            shadowRays.directionZ[i] = direction.z;
+            ignored[i] = (uint32_t) closestTriangles[i].triangleIndex;
+        }
+        PacketUtils::findBlockers(*scene.bvh, shadowRays, count, lightDistances, ignored, blockerDistances);
+    }
+
+    /// @brief Renders every pixel in [x0, x1) x [y0, y1), a row of rays at a time
+    void drawTile(Scene &scene, int x0, int y0, int x1, int y1) {
+        Camera::RayBatch batch;
+        RayTriangleIntersection closestTriangles[Camera::rayBatchSize];
+        float blockerDistances[Camera::rayBatchSize];
+        // soft shadows need the blocker nearest the light, which only the single ray path finds
+        bool shadowPackets = PacketUtils::packetWidth() > 0 && scene.light.mode == Light::PHONG && !scene.light.softShadows;
+        for (int y=y0; y<y1; y++) {
+            for (int x=x0; x<x1; x+=Camera::rayBatchSize) {
+                int count = std::min(Camera::rayBatchSize, x1 - x);
+                scene.camera.generateRays(x, y, batch);
+                findClosestTriangles(scene, batch, count, closestTriangles);
+                if (shadowPackets) findBlockers(scene, closestTriangles, count, blockerDistances);
+                for (int i=0; i<count; i++) {
+                    RayTriangleIntersection &closestTriangle = closestTriangles[i];
+                    if (closestTriangle.distanceFromCamera == FLT_MAX) {
+                        continue; // no triangle intersection found
+                    }
+                    Colour colour;
+                    glm::vec3 pointNormal = RayTracingUtils::calculatePointNormal(*scene.geometry, closestTriangle);
+                    if (scene.mirror && LightingUtils::isMirror(scene.materials[closestTriangle.materialId])) {
+                        colour = LightingUtils::applyMirror(scene, closestTriangle);
+                    } else if (shadowPackets) {
+                        colour = LightingUtils::applyLighting(scene, closestTriangle, pointNormal, blockerDistances[i]);
+                    } else {
+                        colour = LightingUtils::applyLighting(scene, closestTriangle, pointNormal);
+                    }
+                    TriangleUtils::drawPixel(scene.target, CanvasPoint((float) (x + i), (float) y), colour);
+                }
+            }
+        }
     }
 }
 
 namespace RayTracingUtils {
-    /// @brief Uses barycentric coords to figure out normal of point within triangle, given vertex normals
-    glm::vec3 calculatePointNormal(ModelTriangle triangle, glm::vec3 point) {
-        std::array<glm::vec3, 3> vertices = triangle.vertices;
-        glm::vec3 v0 = vertices[1] - vertices[0];
-        glm::vec3 v1 = vertices[2] - vertices[0];
-        glm::vec3 v2 = point - vertices[0];
-        float dotv0v0 = glm::dot(v0, v0);
-        float dotv0v1 = glm::dot(v0, v1);
-        float dotv1v1 = glm::dot(v1, v1);
-        float dotv2v0 = glm::dot(v2, v0);
-        float dotv2v1 = glm::dot(v2, v1);
-        float denominator = dotv0v0 * dotv1v1 - dotv0v1 * dotv0v1;
-        float w1 = (dotv1v1 * dotv2v0 - dotv0v1 * dotv2v1) / denominator;
-        float w2 = (dotv0v0 * dotv2v1 - dotv0v1 * dotv2v0) / denominator;
-        float w0 = 1.f - w1 - w2;
-        return glm::normalize(w0 * triangle.vertexNormals[0] + w1 * triangle.vertexNormals[1] + w2 * triangle.vertexNormals[2]);
+    /// @brief Uses the barycentric coords of the hit to figure out normal of point within triangle, given vertex normals
+    glm::vec3 calculatePointNormal(const Geometry &geometry, const RayTriangleIntersection &intersection) {
+        size_t triangle = intersection.triangleIndex;
+        float w0 = 1.f - intersection.u - intersection.v;
+        glm::vec3 smoothNormal = w0 * geometry.vertexNormal(triangle, 0) + intersection.u * geometry.vertexNormal(triangle, 1) + intersection.v * geometry.vertexNormal(triangle, 2);
+        if (geometry.suppliedNormals) return glm::normalize(smoothNormal); // the model's own normals are used as they are
+        return glm::normalize(smoothNormal + geometry.surfaceNormals.get(triangle)); // the hit triangle's own face counts twice, pulling the normal a little toward flat
     }
 
     /// @brief Returns the triangle that the given ray intersects with first, using given ray (camera or light source)
-    RayTriangleIntersection findClosestTriangle(Scene &scene, Ray ray, bool mirror, int k) {
+    RayTriangleIntersection findClosestTriangle(const Geometry &geometry, const BVH &bvh, Ray ray, bool mirror, int k) {
         RayTriangleIntersection closestTriangle;
         closestTriangle.distanceFromCamera = FLT_MAX;
-        for (size_t i=0; i<scene.triangles.size(); i++) {
-            ModelTriangle triangle = scene.triangles[i];
-            glm::mat3 DEMatrix = calculateDEMatrix(triangle, ray.direction);
-            if (glm::determinant(DEMatrix) == 0) continue; // would be dividing by 0
-            glm::vec3 rawIntersection = calculateRawIntersection(ray.origin, triangle, DEMatrix);
-            if (!validateRawIntersection(rawIntersection)) continue;
-            if (rawIntersection.x >= closestTriangle.distanceFromCamera || closestTriangle.distanceFromCamera <= 0) continue; // something closer already exists
-            if (mirror && i == k) continue; // same triangle we are reflecting from
-            glm::vec3 intersectionPoint = calculateIntersection(DEMatrix, triangle, rawIntersection);
-            closestTriangle = {intersectionPoint, rawIntersection.x, triangle, i};
-        }
-        return closestTriangle;
+        Hit closestHit = {FLT_MAX, 0.f, 0.f, 0};
+        traverse(bvh, ray, closestHit.t, [&](const BVH::Triangle &triangle) {
+            updateClosestHit(triangle, ray, mirror, k, closestHit);
+            return false;
+        });
+        if (closestHit.t == FLT_MAX) return closestTriangle;
+        return makeIntersection(geometry, closestHit);
+    }
+
+    RayTriangleIntersection findClosestTriangle(Scene &scene, Ray ray, bool mirror, int k) {
+        return findClosestTriangle(*scene.geometry, *scene.bvh, ray, mirror, k);
     }
 
-    /// @brief Checks if the point we want to draw on an intersecting triangle is able to see the light source
-    glm::vec3 canSeeLight(Scene &scene, const RayTriangleIntersection &closestTriangle) {
-        // ray using intersection and light source
-        glm::vec3 direction = glm::normalize(closestTriangle.intersectionPoint - scene.light.position);
-        glm::vec3 origin = scene.light.position;
-        Ray ray(origin, direction);
-        // get triangle closest to light source
-        RayTriangleIntersection newClosestTriangle = findClosestTriangle(scene, ray, false, -1);
-        // if triangle we are trying to draw is the triangle closest to the light source
-        // then that means it can see the light. otherwise, it cannot as it's behind another one
-        if (closestTriangle.triangleIndex == newClosestTriangle.triangleIndex) {
-            return {-1.f, -1.f, -1.f}; // true
+    /// @brief Checks if the point we want to draw on an intersecting triangle is able to see the light source.
+    /// Returns -1 if it can, otherwise the distance from the point to the triangle blocking it
+    float canSeeLight(Scene &scene, const RayTriangleIntersection &closestTriangle) {
+        const float epsilon = 1e-4f;
+        glm::vec3 toLight = scene.light.position - closestTriangle.intersectionPoint;
+        float lightDistance = glm::length(toLight);
+        float blockerDistance;
+        if (!scene.light.softShadows) {
+            // hard shadows only need to know that something is in the way, so stop at the first blocker
+            Ray ray(closestTriangle.intersectionPoint, toLight / lightDistance);
+            if (!findBlocker(*scene.bvh, ray, epsilon, lightDistance, closestTriangle.triangleIndex, blockerDistance)) return -1.f;
+            return blockerDistance;
         }
-        return newClosestTriangle.intersectionPoint;
+        // soft shadows fade with distance to the blocker nearest the light, so search from the light instead
+        Ray ray(scene.light.position, -toLight / lightDistance);
+        Hit closestHit = {lightDistance - epsilon, 0.f, 0.f, 0};
+        traverse(*scene.bvh, ray, closestHit.t, [&](const BVH::Triangle &triangle) {
+            updateClosestHit(triangle, ray, true, closestTriangle.triangleIndex, closestHit);
+            return false;
+        });
+        if (closestHit.t == lightDistance - epsilon) return -1.f;
+        return lightDistance - closestHit.t;
     }
 
+    /// @brief Splits the frame into tiles which are shared out between the scene's threads, tracing only the pixels an object in view can cover
     void draw(Scene &scene) {
-        for (int x=0; x<scene.width; x++) {
-            for (int y=0; y<scene.height; y++) {
-                CanvasPoint canvasPoint((float) x, (float) y);
-                if (!TriangleUtils::isInsideCanvas(scene.window, canvasPoint)) continue;
-                Ray ray = calculateRayFromCamera(scene, canvasPoint);
-                RayTriangleIntersection closestTriangle = findClosestTriangle(scene, ray, false, -1);
-                if (closestTriangle.distanceFromCamera == FLT_MAX) {
-                    continue; // no triangle intersection found
-                }
-                Colour colour;
-                glm::vec3 pointNormal = calculatePointNormal(closestTriangle.intersectedTriangle, closestTriangle.intersectionPoint);
-                if (scene.mirror && LightingUtils::isMirror(closestTriangle.intersectedTriangle.colour)) {
-                    colour = LightingUtils::applyMirror(scene, closestTriangle);
-                } else {
-                    colour = LightingUtils::applyLighting(scene, closestTriangle, pointNormal);
-                }
-                TriangleUtils::drawPixel(scene.window, canvasPoint, colour);
+        const int tileSize = 16;
+        int width = (int) scene.width;
+        int height = (int) scene.height;
+        int tilesX = (width + tileSize - 1) / tileSize;
+        int tilesY = (height + tileSize - 1) / tileSize;
+        RasterisingUtils::cullObjects(scene);
+        scene.threadPool->parallelFor(tilesX * tilesY, [&](size_t tile) {
+            TriangleUtils::PixelBounds tileBounds;
+            tileBounds.x0 = (int) (tile % tilesX) * tileSize;
+            tileBounds.y0 = (int) (tile / tilesX) * tileSize;
+            tileBounds.x1 = std::min(tileBounds.x0 + tileSize, width);
+            tileBounds.y1 = std::min(tileBounds.y0 + tileSize, height);
+            // only the part of the tile some object's screen box covers is traced, a ray outside all of them cannot hit anything
+            TriangleUtils::PixelBounds traced = {tileBounds.x1, tileBounds.y1, tileBounds.x0, tileBounds.y0};
+            for (const RasterisingUtils::VisibleObject &visible : scene.visibleObjects) {
+                const TriangleUtils::PixelBounds &bounds = visible.bounds;
+                if (bounds.x0 >= tileBounds.x1 || bounds.x1 <= tileBounds.x0 || bounds.y0 >= tileBounds.y1 || bounds.y1 <= tileBounds.y0) continue;
+                traced.x0 = std::min(traced.x0, std::max(bounds.x0, tileBounds.x0));
+                traced.y0 = std::min(traced.y0, std::max(bounds.y0, tileBounds.y0));
+                traced.x1 = std::max(traced.x1, std::min(bounds.x1, tileBounds.x1));
+                traced.y1 = std::max(traced.y1, std::min(bounds.y1, tileBounds.y1));
             }
-        }
+            if (traced.x0 < traced.x1) drawTile(scene, traced.x0, traced.y0, traced.x1, traced.y1);
+        });
     }
 }
\ No newline at end of file
@@ -2,13 +2,17 @@
 
 #include <glm/glm.hpp>
 #include <RayTriangleIntersection.h>
+#include "Geometry.h"
 #include <Ray.h>
+#include <vector>
 
 class Scene; // pre-declare to avoid circular dependency
+class BVH;
 
 namespace RayTracingUtils {
-    glm::vec3 calculatePointNormal(ModelTriangle triangle, glm::vec3 point);
+    glm::vec3 calculatePointNormal(const Geometry &geometry, const RayTriangleIntersection &intersection);
+    RayTriangleIntersection findClosestTriangle(const Geometry &geometry, const BVH &bvh, Ray ray, bool mirror, int k);
     RayTriangleIntersection findClosestTriangle(Scene &scene, Ray ray, bool mirror, int k);
-    glm::vec3 canSeeLight(Scene &scene, const RayTriangleIntersection &closestTriangle);
+    float canSeeLight(Scene &scene, const RayTriangleIntersection &closestTriangle);
     void draw(Scene &scene);
 }
\ No newline at end of file
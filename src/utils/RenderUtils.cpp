@@ -1,72 +1,255 @@
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <deque>
 #include <iomanip>
+#include <iostream>
 #include "RenderUtils.h"
 #include "Scene.h"
-#include "FilesUtils.h"
+#include "ImageWriter.h"
+#ifndef _WIN32
+#include <poll.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
 
 namespace {
-    void save(Scene &scene, int &count) {
-        scene.draw();
-        scene.window.renderFrame();
-        std::string countStr = std::to_string(count);
+    const int firstFrameNumber = 331;
+    const size_t framesQueuedPerWorker = 2; // drawn frames waiting for the writer, past which workers wait for the disk to catch up
+    const char *const savedPrefix = "Saved frame "; // printed with the frame's number once its file is complete
+    const size_t chunksPerWorker = 4; // runs of frames a coordinator splits the sequence into, so a crash costs little and workers finish together
+    const int maxAttempts = 3; // times a coordinator has a frame drawn before giving up on it
+
+    std::string frameName(int frameNumber) {
+        std::string countStr = std::to_string(frameNumber);
         int numZeros = 5 - countStr.size();
-        std::string name = std::string(numZeros, '0') + countStr;
-        FilesUtils::saveAsImage(scene.window, name);
-        count++;
+        return std::string(numZeros, '0') + countStr;
     }
 
-    void wireFrameSequence(Scene &scene, int &count) {
-        scene.renderMode = Scene::WIRE_FRAME;
+    std::vector<glm::mat4> wireFramePoses(Camera camera) {
+        std::vector<glm::mat4> poses;
         for (int _=0; _<10; _++) {
-            scene.camera.rotate(Camera::Axis::y, 1.f);
-            save(scene, count);
+            camera.rotate(Camera::Axis::y, 1.f);
+            poses.push_back(camera.pose());
         }
+        return poses;
     }
 
-    void rasterisedNavigationSequence(Scene &scene, int &count) {
-        scene.renderMode = Scene::RASTERISED;
+    std::vector<glm::mat4> rasterisedNavigationPoses(Camera camera) {
+        std::vector<glm::mat4> poses;
         for (int _=0; _<40; _++) {
-            scene.camera.translate(Camera::Axis::z, 1.f);
-            save(scene, count);
+            camera.translate(Camera::Axis::z, 1.f);
+            poses.push_back(camera.pose());
         }
         for (int _=0; _<70; _++) {
-            scene.camera.translate(Camera::Axis::y, 1.f);
-            save(scene, count);
+            camera.translate(Camera::Axis::y, 1.f);
+            poses.push_back(camera.pose());
         }
         for (int _=0; _<70; _++) {
-            scene.camera.translate(Camera::Axis::x, -1.f);
-            save(scene, count);
+            camera.translate(Camera::Axis::x, -1.f);
+            poses.push_back(camera.pose());
         }
-        scene.camera.lookAt({0.f, 0.f, 0.f});
-        save(scene, count);
+        camera.lookAt({0.f, 0.f, 0.f});
+        poses.push_back(camera.pose());
         for (int _=0; _<10; _++) {
-            scene.camera.rotate(Camera::Axis::x, -1.f);
-            save(scene, count);
+            camera.rotate(Camera::Axis::x, -1.f);
+            poses.push_back(camera.pose());
         }
         for (int _=0; _<30; _++) {
-            scene.camera.translate(Camera::Axis::z, -1.f);
-            save(scene, count);
+            camera.translate(Camera::Axis::z, -1.f);
+            poses.push_back(camera.pose());
         }
         for (int _=0; _<100; _++) { // orbit
-            scene.camera.rotate(Camera::Axis::y, 1.f);
-            save(scene, count);
+            camera.rotate(Camera::Axis::y, 1.f);
+            poses.push_back(camera.pose());
         }
+        return poses;
     }
 
-    void doSequence(Scene &scene, RenderUtils::Sequence sequence) {
-        int count = 331;
-        switch (sequence) {
-            case RenderUtils::WIRE_FRAME:
-                wireFrameSequence(scene, count);
-                break;
-            case RenderUtils::RASTERISED_NAVIGATION:
-                rasterisedNavigationSequence(scene, count);
-                break;
+    /// @brief Draws frames [first, end) of the poses, several at once, each worker on its own copy of the scene sharing the model.
+    /// Finished frames go to an ImageWriter that saves them in order, so drawing only waits for the disk when it falls behind.
+    /// Returns false if any frame could not be saved
+    bool renderFrames(Scene &scene, const std::vector<glm::mat4> &poses, size_t first, size_t end, ImageUtils::Format format) {
+        size_t workerCount = std::min(end - first, (size_t) scene.threadPool->size());
+        std::atomic<size_t> nextFrame(first);
+        bool saved = true;
+        ImageWriter writer(first, framesQueuedPerWorker * workerCount, format, scene.threadPool->size(), [&](size_t frame, bool frameSaved) {
+            // a coordinator reads these to know which frames a worker that dies has already done
+            if (frameSaved) std::cout << savedPrefix << frame << std::endl;
+            else saved = false;
+        });
+        scene.threadPool->parallelFor(workerCount, [&](size_t) {
+            Scene frameScene(scene);
+            frameScene.setThreadCount(1); // frames are drawn side by side rather than split up
+            for (size_t frame=nextFrame++; frame<end; frame=nextFrame++) {
+                if (frameScene.target.width == 0) frameScene.target = writer.takeSpare((int) scene.width, (int) scene.height);
+                frameScene.camera.setPose(poses[frame]);
+                frameScene.draw();
+                writer.save(frame, std::move(frameScene.target), frameName(firstFrameNumber + (int) frame));
+                frameScene.target = RenderTarget();
+            }
+        });
+        writer.finish();
+        if (end > first) scene.camera.setPose(poses[end - 1]);
+        return saved;
+    }
+
+#ifndef _WIN32
+    /// @brief A worker process drawing a range of frames, whose standard output comes back through a pipe
+    struct Worker {
+        pid_t pid;
+        int output;
+        RenderUtils::FrameRange frames;
+        std::string line; // output so far of a line not yet finished
+    };
+
+    bool launchWorker(const std::string &program, RenderUtils::FrameRange frames, int threads, ImageUtils::Format format, Worker &worker) {
+        int pipeEnds[2];
+        if (pipe(pipeEnds) == -1) return false;
+        std::string range = std::to_string(frames.first) + ":" + std::to_string(frames.end);
+        std::string threadCount = std::to_string(threads);
+        pid_t pid = fork();
+        if (pid == -1) {
+            close(pipeEnds[0]);
+            close(pipeEnds[1]);
+            return false;
+        }
+        if (pid == 0) {
+            dup2(pipeEnds[1], STDOUT_FILENO);
+            close(pipeEnds[0]);
+            close(pipeEnds[1]);
+            const char *arguments[] = {program.c_str(), "--headless", "--frames", range.c_str(), "--threads", threadCount.c_str(), "--format", ImageUtils::extension(format), nullptr};
+            execvp(program.c_str(), const_cast<char *const *>(arguments));
+            _exit(127);
         }
+        close(pipeEnds[1]);
+        worker = {pid, pipeEnds[0], frames, ""};
+        return true;
     }
+
+    /// @brief Marks the frames a worker reports as saved, passing everything else it prints on
+    void readWorkerOutput(Worker &worker, const char *bytes, size_t count, std::vector<bool> &saved) {
+        for (size_t i=0; i<count; i++) {
+            if (bytes[i] != '\n') {
+                worker.line += bytes[i];
+                continue;
+            }
+            if (worker.line.compare(0, std::strlen(savedPrefix), savedPrefix) == 0) {
+                size_t frame = std::strtoull(worker.line.c_str() + std::strlen(savedPrefix), nullptr, 10);
+                if (frame >= worker.frames.first && frame < worker.frames.end) saved[frame] = true;
+            } else std::cout << worker.line << std::endl;
+            worker.line.clear();
+        }
+    }
+#endif
 }
 
 namespace RenderUtils {
-    void generate(Scene &scene, Sequence sequence) {
-        doSequence(scene, sequence);
+    /// @brief The pose of the camera in each frame of the sequence, moving it on from where camera is
+    std::vector<glm::mat4> poses(Sequence sequence, const Camera &camera) {
+        switch (sequence) {
+            case WIRE_FRAME:
+                return wireFramePoses(camera);
+            case RASTERISED_NAVIGATION:
+                return rasterisedNavigationPoses(camera);
+        }
+        return {};
+    }
+
+    /// @brief How many frames the sequence has, which does not depend on where its camera starts
+    size_t frameCount(Sequence sequence) {
+        return poses(sequence, Camera(1.f, 1.f, glm::vec3(0.f, 0.f, 4.f), false)).size();
+    }
+
+    /// @brief The index-th of count nearly equal runs of frames the sequence is split into, for a process to draw by itself
+    FrameRange shard(Sequence sequence, size_t index, size_t count) {
+        size_t frames = frameCount(sequence);
+        if (count == 0 || index >= count) return {0, 0};
+        return {frames * index / count, frames * (index + 1) / count};
+    }
+
+    /// @brief Draws the sequence's frames in the range into output/ in the format, returning false if any could not be saved
+    bool generate(Scene &scene, Sequence sequence, FrameRange frames, ImageUtils::Format format) {
+        std::vector<glm::mat4> framePoses = poses(sequence, scene.camera);
+        scene.renderMode = sequence == WIRE_FRAME ? Scene::WIRE_FRAME : Scene::RASTERISED;
+        size_t end = std::min(frames.end, framePoses.size());
+        size_t first = std::min(frames.first, end);
+        return renderFrames(scene, framePoses, first, end, format);
+    }
+
+#ifdef _WIN32
+    bool coordinate(const std::string &, Sequence, int, int, ImageUtils::Format) {
+        std::cout << "Worker processes are not supported on Windows, use --shard on each instead" << std::endl;
+        return false;
+    }
+#else
+    /// @brief Draws the whole sequence with workerCount copies of program, handing each a run of frames at a time.
+    /// The frames a worker had not saved when it crashed go back on the queue, up to maxAttempts times each
+    bool coordinate(const std::string &program, Sequence sequence, int workerCount, int threadsPerWorker, ImageUtils::Format format) {
+        size_t frames = frameCount(sequence);
+        size_t chunkSize = std::max((size_t) 1, frames / (chunksPerWorker * std::max(workerCount, 1)));
+        std::deque<FrameRange> queue;
+        for (size_t first=0; first<frames; first+=chunkSize) queue.push_back({first, std::min(first + chunkSize, frames)});
+        std::vector<bool> saved(frames, false);
+        std::vector<int> attempts(frames, 0);
+        std::vector<Worker> workers;
+        bool complete = true;
+        while (!queue.empty() || !workers.empty()) {
+            while ((int) workers.size() < workerCount && !queue.empty()) {
+                FrameRange range = queue.front();
+                queue.pop_front();
+                Worker worker;
+                if (!launchWorker(program, range, threadsPerWorker, format, worker)) {
+                    std::cout << "Could not start a worker: " << std::strerror(errno) << std::endl;
+                    complete = false;
+                    continue;
+                }
+                for (size_t frame=range.first; frame<range.end; frame++) attempts[frame]++;
+                workers.push_back(std::move(worker));
+            }
+            if (workers.empty()) break;
+            std::vector<pollfd> outputs;
+            for (const Worker &worker : workers) outputs.push_back({worker.output, POLLIN, 0});
+            if (poll(outputs.data(), outputs.size(), -1) == -1 && errno != EINTR) break;
+            for (size_t i=workers.size(); i-->0;) {
+                if (outputs[i].revents == 0) continue;
+                Worker &worker = workers[i];
+                char buffer[4096];
+                ssize_t count = read(worker.output, buffer, sizeof(buffer));
+                if (count > 0) {
+                    readWorkerOutput(worker, buffer, (size_t) count, saved);
+                    continue;
+                }
+                if (count == -1 && errno == EINTR) continue;
+                // the pipe closed, so the worker has finished or died
+                close(worker.output);
+                int status = 0;
+                waitpid(worker.pid, &status, 0);
+                bool succeeded = WIFEXITED(status) && WEXITSTATUS(status) == 0;
+                FrameRange range = worker.frames;
+                workers.erase(workers.begin() + (long) i);
+                // whatever it did not report saving, success or not, is drawn again by another worker
+                for (size_t frame=range.first; frame<range.end;) {
+                    if (saved[frame]) {
+                        frame++;
+                        continue;
+                    }
+                    size_t runEnd = frame;
+                    while (runEnd < range.end && !saved[runEnd]) runEnd++;
+                    std::string frameRange = std::to_string(frame) + ":" + std::to_string(runEnd);
+                    if (attempts[frame] >= maxAttempts) {
+                        std::cout << "Giving up on frames " << frameRange << " after " << maxAttempts << " attempts" << std::endl;
+                        complete = false;
+                    } else {
+                        std::cout << "Worker for frames " << range.first << ":" << range.end << (succeeded ? " exited" : " crashed") << ", drawing frames " << frameRange << " again" << std::endl;
+                        queue.push_back({frame, runEnd});
+                    }
+                    frame = runEnd;
+                }
+            }
+        }
+        return complete && std::find(saved.begin(), saved.end(), false) == saved.end();
     }
+#endif
 }
\ No newline at end of file
@@ -1,11 +1,28 @@
 #pragma once
 
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "ImageUtils.h"
+
 class Scene;
+class Camera;
 
 namespace RenderUtils {
     enum Sequence {
         WIRE_FRAME, // show wire frame
         RASTERISED_NAVIGATION, // pos, orientation, orbit, lookAt
     };
-    void generate(Scene &scene, Sequence sequence);
+    /// @brief Frames [first, end) of a sequence, numbered from 0. Each frame's file is named after its number, whichever process draws it
+    struct FrameRange {
+        size_t first = 0;
+        size_t end = SIZE_MAX; // clamped to the length of the sequence
+    };
+    std::vector<glm::mat4> poses(Sequence sequence, const Camera &camera);
+    size_t frameCount(Sequence sequence);
+    FrameRange shard(Sequence sequence, size_t index, size_t count);
+    bool generate(Scene &scene, Sequence sequence, FrameRange frames = FrameRange(), ImageUtils::Format format = ImageUtils::PPM);
+    bool coordinate(const std::string &program, Sequence sequence, int workerCount, int threadsPerWorker, ImageUtils::Format format);
 }
\ No newline at end of file
@@ -1,24 +1,16 @@
 #include "TriangleUtils.h"
 #include <algorithm>
+#include <array>
 #include <vector>
 #include <cmath>
 #include "Scene.h"
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
 
 namespace {
-    /// @brief Uses barycentric coords to figure out depth of point within triangle
-    float calculatePointDepth(CanvasTriangle triangle, CanvasPoint point) {
-        float denominator = (triangle.v1().y-triangle.v2().y)*(triangle.v0().x-triangle.v2().x)+(triangle.v2().x-triangle.v1().x)*(triangle.v0().y-triangle.v2().y);
-        float w0 = ((triangle.v1().y-triangle.v2().y)*(point.x-triangle.v2().x)+(triangle.v2().x-triangle.v1().x)*(point.y-triangle.v2().y))/denominator;
-        float w1 = ((triangle.v2().y-triangle.v0().y)*(point.x-triangle.v2().x)+(triangle.v0().x-triangle.v2().x)*(point.y-triangle.v2().y))/denominator;
-        float w2 = 1.0f - w0 - w1;
-        if (w0 < 0 || w1 < 0 || w2 < 0) {
-            return 0; // point is not inside the triangle
-        }
-        return 1/((w0 * triangle.v0().depth) + (w1 * triangle.v1().depth) + (w2 * triangle.v2().depth));
-    }
-
     /// @brief Makes the smallest possible rectangle around a given triangle
-    std::vector<float> boundingBox(CanvasTriangle triangle) {
+    std::array<float, 4> boundingBox(CanvasTriangle triangle) {
         float minX = std::min({triangle.v0().x, triangle.v1().x, triangle.v2().x});
         float maxX = std::max({triangle.v0().x, triangle.v1().x, triangle.v2().x});
         float minY = std::min({triangle.v0().y, triangle.v1().y, triangle.v2().y});
@@ -26,73 +18,308 @@ namespace {
         return {minX, maxX, minY, maxY};
     }
 
-    /// @brief Draws a coloured line on canvas from given point to another
-    void drawLine(DrawingWindow &window, CanvasPoint from, CanvasPoint to, Colour colour) {
-        float xDiff = to.x - from.x;
-        float yDiff = to.y - from.y;
-        float numSteps = std::max(abs(xDiff), abs(yDiff));
-        float xStepSize = xDiff / numSteps;
-        float yStepSize = yDiff / numSteps;
-        for (float i=0.0; i<numSteps; i++) {
-            float x = from.x + (xStepSize * i);
-            float y = from.y + (yStepSize * i);
-            CanvasPoint canvasPoint(x, y);
-            if (!TriangleUtils::isInsideCanvas(window, canvasPoint)) continue;
-            TriangleUtils::drawPixel(window, canvasPoint, colour);
+    /// @brief Whether the rectangle [x0, x1] x [y0, y1] lies wholly outside one of the triangle's edges, checked at the corner furthest inside
+    bool outsideEdge(const TriangleUtils::TriangleSetup &setup, float x0, float y0, float x1, float y1) {
+        for (int i=0; i<3; i++) {
+            float x = setup.edgeA[i] > 0.f ? x1 : x0;
+            float y = setup.edgeB[i] > 0.f ? y1 : y0;
+            if (setup.edgeA[i] * (x - setup.originX[i]) + setup.edgeB[i] * (y - setup.originY[i]) < 0.f) return true;
         }
+        return false;
     }
-}
 
-namespace TriangleUtils {
-    glm::vec3 calculateVertexNormals(ModelTriangle modelTriangle, std::vector<ModelTriangle> modelTriangles, glm::vec3 v) {
-        glm::vec3 vertexNormal = modelTriangle.surfaceNormal;
-        for (int j=0; j<modelTriangles.size(); j++) {
-            if (v == modelTriangles[j].vertices[0] || v == modelTriangles[j].vertices[1] || v == modelTriangles[j].vertices[2]) {
-                vertexNormal += modelTriangles[j].surfaceNormal;
+    const int insideRegion = 0;
+    const int leftRegion = 1;
+    const int rightRegion = 2;
+    const int belowRegion = 4;
+    const int aboveRegion = 8;
+
+    /// @brief Cohen-Sutherland region code of a point, a bit for each side of the rectangle [minX, maxX] x [minY, maxY] it lies beyond
+    int regionCode(float x, float y, float minX, float minY, float maxX, float maxY) {
+        int code = insideRegion;
+        if (x < minX) code |= leftRegion;
+        else if (x > maxX) code |= rightRegion;
+        if (y < minY) code |= belowRegion;
+        else if (y > maxY) code |= aboveRegion;
+        return code;
+    }
+
+    /// @brief Cuts the line down to the part inside the rectangle [minX, maxX] x [minY, maxY] (Cohen-Sutherland), false if none of it is
+    bool clipLine(CanvasPoint &from, CanvasPoint &to, float minX, float minY, float maxX, float maxY) {
+        int fromCode = regionCode(from.x, from.y, minX, minY, maxX, maxY);
+        int toCode = regionCode(to.x, to.y, minX, minY, maxX, maxY);
+        while (true) {
+            if ((fromCode | toCode) == insideRegion) return true;
+            if ((fromCode & toCode) != insideRegion) return false; // both ends beyond the same side
+            // move an end that is outside onto the side it lies beyond, which clears that side's bit
+            int code = fromCode != insideRegion ? fromCode : toCode;
+            float x, y;
+            if (code & leftRegion) {
+                x = minX;
+                y = from.y + (to.y - from.y) * (minX - from.x) / (to.x - from.x);
+            } else if (code & rightRegion) {
+                x = maxX;
+                y = from.y + (to.y - from.y) * (maxX - from.x) / (to.x - from.x);
+            } else if (code & belowRegion) {
+                x = from.x + (to.x - from.x) * (minY - from.y) / (to.y - from.y);
+                y = minY;
+            } else {
+                x = from.x + (to.x - from.x) * (maxY - from.y) / (to.y - from.y);
+                y = maxY;
+            }
+            if (code == fromCode) {
+                from.x = x;
+                from.y = y;
+                fromCode = regionCode(x, y, minX, minY, maxX, maxY);
+            } else {
+                to.x = x;
+                to.y = y;
+                toCode = regionCode(x, y, minX, minY, maxX, maxY);
             }
         }
-        return vertexNormal;
     }
 
-    glm::vec3 calculateSurfaceNormal(std::array<glm::tvec3<float>, 3> vertices) {
-        return glm::cross(vertices[1] - vertices[0], vertices[2] - vertices[0]);
+    /// @brief Mixes colour into the pixel, coverage out of 256
+    void blendPixel(uint32_t *pixel, const Colour &colour, int coverage) {
+        uint32_t background = *pixel;
+        int red = (int) ((background >> 16) & 0xFF);
+        int green = (int) ((background >> 8) & 0xFF);
+        int blue = (int) (background & 0xFF);
+        red += ((colour.red - red) * coverage) >> 8;
+        green += ((colour.green - green) * coverage) >> 8;
+        blue += ((colour.blue - blue) * coverage) >> 8;
+        *pixel = (255u << 24) | ((uint32_t) red << 16) | ((uint32_t) green << 8) | (uint32_t) blue;
     }
+}
 
+namespace TriangleUtils {
     /// @brief Checks if given point is outside of canvas bounds
-    bool isInsideCanvas(DrawingWindow &window, CanvasPoint point) {
-        if (point.x < 0 || point.x >= window.width || point.y < 0 || point.y >= window.height) {
+    bool isInsideCanvas(RenderTarget &target, CanvasPoint point) {
+        if (point.x < 0 || point.x >= target.width || point.y < 0 || point.y >= target.height) {
             return false; // point is outside frame
         }
         return true;
     }
 
-    void drawPixel(DrawingWindow &window, CanvasPoint point, Colour colour) {
-        uint32_t colourCode = (255 << 24) + (colour.red << 16) + (colour.green << 8) + colour.blue;
-        window.setPixelColour(point.x, point.y, colourCode);
+    uint32_t packColour(const Colour &colour) {
+        return (255 << 24) + (colour.red << 16) + (colour.green << 8) + colour.blue;
+    }
+
+    void drawPixel(RenderTarget &target, CanvasPoint point, Colour colour) {
+        target.setPixelColour(point.x, point.y, packColour(colour));
+    }
+
+    /// @brief Draws a line between two canvas points with integer steps (Bresenham). The line is clipped to the canvas first, so every pixel stepped to is written unchecked
+    void drawLine(RenderTarget &target, CanvasPoint from, CanvasPoint to, uint32_t colour) {
+        // a pixel covers [x, x + 1), so anything short of the far edge truncates onto the last column or row
+        const float edge = 1.f / 1024.f;
+        if (!clipLine(from, to, 0.f, 0.f, target.width - edge, target.height - edge)) return;
+        int x0 = (int) from.x;
+        int y0 = (int) from.y;
+        int x1 = (int) to.x;
+        int y1 = (int) to.y;
+        int dx = std::abs(x1 - x0);
+        int dy = -std::abs(y1 - y0);
+        int stepX = x0 < x1 ? 1 : -1;
+        ptrdiff_t stepY = y0 < y1 ? (ptrdiff_t) target.width : -(ptrdiff_t) target.width;
+        uint32_t *pixel = target.getPixelRow(y0) + x0;
+        int error = dx + dy; // how far the next pixel is off the true line, scaled by 2 * dx * dy to stay whole
+        int steps = std::max(dx, -dy);
+        while (true) {
+            *pixel = colour;
+            if (steps-- == 0) break;
+            int doubled = 2 * error;
+            if (doubled >= dy) {
+                error += dy;
+                pixel += stepX;
+            }
+            if (doubled <= dx) {
+                error += dx;
+                pixel += stepY;
+            }
+        }
+    }
+
+    /// @brief Draws an anti-aliased line between two canvas points (Wu). Along the longer axis each step covers two pixels across the line,
+    /// weighted by how close the line passes to their centres, with the position across kept in 16.16 fixed point
+    void drawSmoothLine(RenderTarget &target, CanvasPoint from, CanvasPoint to, const Colour &colour) {
+        // pixel centres are clipped to, so the pair straddling the line is always on the canvas
+        if (!clipLine(from, to, 0.5f, 0.5f, target.width - 0.5f, target.height - 0.5f)) return;
+        bool steep = std::abs(to.y - from.y) > std::abs(to.x - from.x);
+        float major0 = (steep ? from.y : from.x) - 0.5f; // relative to pixel centres
+        float minor0 = (steep ? from.x : from.y) - 0.5f;
+        float major1 = (steep ? to.y : to.x) - 0.5f;
+        float minor1 = (steep ? to.x : to.y) - 0.5f;
+        if (major0 > major1) {
+            std::swap(major0, major1);
+            std::swap(minor0, minor1);
+        }
+        int first = (int) std::ceil(major0);
+        int last = (int) std::floor(major1);
+        if (first > last) return; // shorter than a pixel, passes between centres
+        float gradient = major1 > major0 ? (minor1 - minor0) / (major1 - major0) : 0.f;
+        const float one = 65536.f;
+        // rounding can leave the ends a hair off the canvas, which would put the far pixel of the pair on the next row
+        float minorMax = (steep ? target.width : target.height) - 1.f;
+        int32_t minor = (int32_t) (std::clamp(minor0 + gradient * (first - major0), 0.f, minorMax) * one);
+        int32_t minorLast = (int32_t) (std::clamp(minor0 + gradient * (last - major0), 0.f, minorMax) * one);
+        // stepping by the truncated per step change never carries the line past its last pixel's minor position
+        int32_t minorStep = last > first ? (minorLast - minor) / (last - first) : 0;
+        ptrdiff_t majorStride = steep ? (ptrdiff_t) target.width : 1;
+        ptrdiff_t minorStride = steep ? 1 : (ptrdiff_t) target.width;
+        uint32_t *pixels = target.getPixelRow(0);
+        for (int major=first; major<=last; major++, minor+=minorStep) {
+            uint32_t *pixel = pixels + major * majorStride + (minor >> 16) * minorStride;
+            int coverage = (minor >> 8) & 0xFF; // of the pixel beyond, what is left goes to the nearer one
+            blendPixel(pixel, colour, 256 - coverage);
+            if (coverage > 0) blendPixel(pixel + minorStride, colour, coverage);
+        }
+    }
+
+    /// @brief Pixels the fill loop visits for the triangle, clipped to a width x height canvas. False if there are none
+    bool pixelBounds(CanvasTriangle triangle, int width, int height, PixelBounds &bounds) {
+        std::array<float, 4> boundedBy = boundingBox(triangle);
+        // written so that NaN corners fail the test, the fill loop draws nothing for them either
+        if (!(boundedBy[0] < width && boundedBy[1] > 0.f && boundedBy[2] < height && boundedBy[3] > 0.f)) return false;
+        // the loop starts at the truncated minimum and runs while below the maximum
+        bounds.x0 = std::max(0, (int) boundedBy[0]);
+        bounds.x1 = (int) std::ceil(std::min(boundedBy[1], (float) width));
+        bounds.y0 = std::max(0, (int) boundedBy[2]);
+        bounds.y1 = (int) std::ceil(std::min(boundedBy[3], (float) height));
+        return bounds.x0 < bounds.x1 && bounds.y0 < bounds.y1;
     }
 
-    void drawStrokedTriangle(Scene &scene, CanvasTriangle triangle) {
-        Colour colour(255, 255, 255);
-        drawLine(scene.window, triangle.v0(), triangle.v1(), colour);
-        drawLine(scene.window, triangle.v1(), triangle.v2(), colour);
-        drawLine(scene.window, triangle.v2(), triangle.v0(), colour);
+    /// @brief Works out the triangle's edge equations and depth plane, false if it is degenerate or covers no pixels of a width x height canvas
+    bool setupTriangle(const CanvasTriangle &triangle, int width, int height, TriangleSetup &setup) {
+        if (!pixelBounds(triangle, width, height, setup.bounds)) return false;
+        const std::array<CanvasPoint, 3> &v = triangle.vertices;
+        for (int i=0; i<3; i++) {
+            const CanvasPoint &from = v[(i + 1) % 3];
+            const CanvasPoint &to = v[(i + 2) % 3];
+            setup.edgeA[i] = from.y - to.y;
+            setup.edgeB[i] = to.x - from.x;
+            setup.originX[i] = from.x;
+            setup.originY[i] = from.y;
+        }
+        float area = setup.edgeA[0] * (v[0].x - v[1].x) + setup.edgeB[0] * (v[0].y - v[1].y); // twice the signed area
+        if (!(area != 0.f)) return false; // degenerate, or NaN corners
+        if (area < 0.f) {
+            // wound the other way, flip the edges so the inside is positive either way round
+            for (int i=0; i<3; i++) {
+                setup.edgeA[i] = -setup.edgeA[i];
+                setup.edgeB[i] = -setup.edgeB[i];
+            }
+            area = -area;
+        }
+        for (int i=0; i<3; i++) {
+            // the edge normal points inwards, a left edge has the inside to its right and a top edge (y grows downwards) has it below
+            setup.topLeft[i] = setup.edgeA[i] > 0.f || (setup.edgeA[i] == 0.f && setup.edgeB[i] > 0.f);
+        }
+        // depth = w0 * d0 + w1 * d1 + w2 * d2 with wi = edge i / area, written as a plane through corner 0
+        float depth1 = v[1].depth - v[0].depth;
+        float depth2 = v[2].depth - v[0].depth;
+        setup.depth = v[0].depth;
+        setup.depthX = (depth1 * setup.edgeA[1] + depth2 * setup.edgeA[2]) / area;
+        setup.depthY = (depth1 * setup.edgeB[1] + depth2 * setup.edgeB[2]) / area;
+        setup.depthOriginX = v[0].x;
+        setup.depthOriginY = v[0].y;
+        // the stored depth is 1 / interpolated depth, so across the triangle it peaks at the corner nearest the camera
+        float minimumDepth = std::min({v[0].depth, v[1].depth, v[2].depth});
+        setup.nearestDepth = minimumDepth > 0.f ? 1.f / minimumDepth : INFINITY;
+        return true;
     }
 
-    void drawFilledTriangle(Scene &scene, CanvasTriangle triangle, Colour colour) {
-        // we should be getting the smallest possible bounding box for the triangle rather than iterating over all of them
-        std::vector<float> boundedBy = boundingBox(triangle);
-        for (int x=boundedBy[0]; x<boundedBy[1]; x++) {
-            for (int y=boundedBy[2]; y<boundedBy[3]; y++) {
-                CanvasPoint canvasPoint(x, y);
-                float depth = calculatePointDepth(triangle, canvasPoint);
-                if (depth == 0) continue; // point is outside triangle
-                if (!isInsideCanvas(scene.window, canvasPoint)) continue;
-                if (depth < scene.camera.depthBuffer[x][y]) {
-                    continue; // something in front of our pixel has already been placed
+    /// @brief Fills the part of the triangle inside the tile, testing against and updating the target's depth buffer one 8x8 block at a time.
+    /// Pixels are sampled at their integer coordinates and the stored depth is 1 / interpolated canvas depth, larger is closer.
+    /// Blocks whose farthest depth is in front of the whole triangle are skipped. Returns whether any pixel was drawn
+    bool drawFilledTriangle(RenderTarget &target, const TriangleSetup &setup, uint32_t colour, const PixelBounds &tile, CullStats &stats) {
+        const int blockSize = RenderTarget::depthBlockSize;
+        int x0 = std::max(setup.bounds.x0, tile.x0);
+        int x1 = std::min(setup.bounds.x1, tile.x1);
+        int y0 = std::max(setup.bounds.y0, tile.y0);
+        int y1 = std::min(setup.bounds.y1, tile.y1);
+        if (x0 >= x1 || y0 >= y1) return false;
+        bool drewTriangle = false;
+#if defined(__AVX2__)
+        // a row of a block is 8 pixels, one per lane, lanes outside [x0, x1) are masked off
+        const __m256 zero = _mm256_setzero_ps();
+        const __m256 laneOffsets = _mm256_setr_ps(0.f, 1.f, 2.f, 3.f, 4.f, 5.f, 6.f, 7.f);
+        const __m256i laneIndices = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+        __m256 topLeft[3];
+        for (int i=0; i<3; i++) topLeft[i] = _mm256_castsi256_ps(_mm256_set1_epi32(setup.topLeft[i] ? -1 : 0));
+        __m256 one = _mm256_set1_ps(1.f);
+        __m256i colours = _mm256_set1_epi32((int) colour);
+#endif
+        for (int blockY=y0/blockSize; blockY<=(y1-1)/blockSize; blockY++) {
+            int rowStart = std::max(y0, blockY * blockSize);
+            int rowEnd = std::min(y1, (blockY + 1) * blockSize);
+            for (int blockX=x0/blockSize; blockX<=(x1-1)/blockSize; blockX++) {
+                int left = blockX * blockSize;
+                if (setup.nearestDepth < target.getFarthestDepth(blockX, blockY)) {
+                    stats.skippedPixelTests += (rowEnd - rowStart) * (std::min(x1, left + blockSize) - std::max(x0, left));
+                    continue;
+                }
+                if (outsideEdge(setup, (float) left, (float) rowStart, (float) (left + blockSize - 1), (float) (rowEnd - 1))) continue;
+                float *block = target.getDepthBlock(blockX, blockY);
+                bool drewBlock = false;
+#if defined(__AVX2__)
+                // the x terms are the same for every row of the block
+                __m256 pixelX = _mm256_add_ps(_mm256_set1_ps((float) left), laneOffsets);
+                __m256 columns = _mm256_castsi256_ps(_mm256_and_si256(_mm256_cmpgt_epi32(laneIndices, _mm256_set1_epi32(x0 - left - 1)), _mm256_cmpgt_epi32(_mm256_set1_epi32(x1 - left), laneIndices)));
+                __m256 edgeColumns[3];
+                for (int i=0; i<3; i++) edgeColumns[i] = _mm256_mul_ps(_mm256_set1_ps(setup.edgeA[i]), _mm256_sub_ps(pixelX, _mm256_set1_ps(setup.originX[i])));
+                __m256 depthColumns = _mm256_mul_ps(_mm256_set1_ps(setup.depthX), _mm256_sub_ps(pixelX, _mm256_set1_ps(setup.depthOriginX)));
+                for (int y=rowStart; y<rowEnd; y++) {
+                    __m256 inside = columns;
+                    for (int i=0; i<3; i++) {
+                        __m256 edge = _mm256_add_ps(edgeColumns[i], _mm256_set1_ps(setup.edgeB[i] * ((float) y - setup.originY[i])));
+                        __m256 covered = _mm256_or_ps(_mm256_cmp_ps(edge, zero, _CMP_GT_OQ), _mm256_and_ps(_mm256_cmp_ps(edge, zero, _CMP_EQ_OQ), topLeft[i]));
+                        inside = _mm256_and_ps(inside, covered);
+                    }
+                    if (_mm256_movemask_ps(inside) == 0) continue;
+                    __m256 depthRow = _mm256_set1_ps(setup.depth + setup.depthY * ((float) y - setup.depthOriginY));
+                    __m256 depth = _mm256_div_ps(one, _mm256_add_ps(depthRow, depthColumns));
+                    float *depthSamples = block + (y - blockY * blockSize) * blockSize;
+                    __m256 stored = _mm256_load_ps(depthSamples);
+                    __m256 drawn = _mm256_and_ps(inside, _mm256_cmp_ps(depth, stored, _CMP_GE_OQ)); // something in front has already been placed otherwise
+                    _mm256_store_ps(depthSamples, _mm256_blendv_ps(stored, depth, drawn));
+                    _mm256_maskstore_epi32((int *) (target.getPixelRow(y) + left), _mm256_castps_si256(drawn), colours);
+                    drewBlock = drewBlock || _mm256_movemask_ps(drawn) != 0;
+                }
+                if (drewBlock) {
+                    __m256 farthest = _mm256_load_ps(block);
+                    for (int row=1; row<blockSize; row++) farthest = _mm256_min_ps(farthest, _mm256_load_ps(block + row * blockSize));
+                    farthest = _mm256_min_ps(farthest, _mm256_permute2f128_ps(farthest, farthest, 1));
+                    farthest = _mm256_min_ps(farthest, _mm256_shuffle_ps(farthest, farthest, _MM_SHUFFLE(1, 0, 3, 2)));
+                    farthest = _mm256_min_ps(farthest, _mm256_shuffle_ps(farthest, farthest, _MM_SHUFFLE(2, 3, 0, 1)));
+                    target.setFarthestDepth(blockX, blockY, _mm256_cvtss_f32(farthest));
+                }
+#else
+                for (int y=rowStart; y<rowEnd; y++) {
+                    float edgeRow[3];
+                    for (int i=0; i<3; i++) edgeRow[i] = setup.edgeB[i] * ((float) y - setup.originY[i]);
+                    float depthRow = setup.depth + setup.depthY * ((float) y - setup.depthOriginY);
+                    float *depthSamples = block + (y - blockY * blockSize) * blockSize;
+                    uint32_t *pixels = target.getPixelRow(y);
+                    for (int x=std::max(x0, left); x<std::min(x1, left + blockSize); x++) {
+                        bool inside = true;
+                        for (int i=0; i<3; i++) {
+                            float edge = setup.edgeA[i] * ((float) x - setup.originX[i]) + edgeRow[i];
+                            inside = inside && (edge > 0.f || (edge == 0.f && setup.topLeft[i]));
+                        }
+                        if (!inside) continue;
+                        float depth = 1.f / (depthRow + setup.depthX * ((float) x - setup.depthOriginX));
+                        if (depth < depthSamples[x - left]) continue; // something in front of our pixel has already been placed
+                        depthSamples[x - left] = depth;
+                        pixels[x] = colour;
+                        drewBlock = true;
+                    }
                 }
-                drawPixel(scene.window, canvasPoint, colour);
-                scene.camera.depthBuffer[x][y] = depth;
+                if (drewBlock) target.setFarthestDepth(blockX, blockY, *std::min_element(block, block + blockSize * blockSize));
+#endif
+                drewTriangle = drewTriangle || drewBlock;
             }
         }
+        return drewTriangle;
     }
 }
\ No newline at end of file
@@ -1,6 +1,6 @@
 #pragma once
 
-#include <DrawingWindow.h>
+#include <RenderTarget.h>
 #include <CanvasPoint.h>
 #include <CanvasTriangle.h>
 #include <Colour.h>
@@ -9,10 +9,36 @@
 class Scene; // pre-declare to avoid circular dependency
 
 namespace TriangleUtils {
-    glm::vec3 calculateVertexNormals(ModelTriangle modelTriangle, std::vector<ModelTriangle> modelTriangles, glm::vec3 v);
-    glm::vec3 calculateSurfaceNormal(std::array<glm::tvec3<float>, 3> vertices);
-    bool isInsideCanvas(DrawingWindow &window, CanvasPoint point);
-    void drawPixel(DrawingWindow &window, CanvasPoint point, Colour colour);
-    void drawStrokedTriangle(Scene &scene, CanvasTriangle triangle);
-    void drawFilledTriangle(Scene &scene, CanvasTriangle triangle, Colour colour);
+    /// @brief Pixels [x0, x1) x [y0, y1) a triangle can cover, already clipped to the canvas
+    struct PixelBounds {
+        int x0, y0, x1, y1;
+    };
+    /// @brief Edge equations and depth plane of a canvas triangle, worked out once so filling it only evaluates them
+    struct TriangleSetup {
+        PixelBounds bounds;
+        float edgeA[3]; // edge i, opposite corner i, is edgeA[i] * (x - originX[i]) + edgeB[i] * (y - originY[i]), positive inside
+        float edgeB[3];
+        float originX[3];
+        float originY[3];
+        bool topLeft[3]; // pixels exactly on a top or left edge belong to this triangle, ones on other edges to its neighbour
+        float depth; // the canvas depth interpolates as depth + depthX * (x - depthOriginX) + depthY * (y - depthOriginY)
+        float depthX;
+        float depthY;
+        float depthOriginX;
+        float depthOriginY;
+        float nearestDepth; // largest depth any pixel of the triangle can have, infinite if a corner is not in front of the camera
+    };
+    /// @brief Work the hierarchical depth test saved while filling
+    struct CullStats {
+        size_t culledTriangles = 0; // counted once for every tile a triangle was rejected from whole
+        size_t skippedPixelTests = 0;
+    };
+    bool isInsideCanvas(RenderTarget &target, CanvasPoint point);
+    void drawPixel(RenderTarget &target, CanvasPoint point, Colour colour);
+    void drawLine(RenderTarget &target, CanvasPoint from, CanvasPoint to, uint32_t colour);
+    void drawSmoothLine(RenderTarget &target, CanvasPoint from, CanvasPoint to, const Colour &colour);
+    bool pixelBounds(CanvasTriangle triangle, int width, int height, PixelBounds &bounds);
+    uint32_t packColour(const Colour &colour);
+    bool setupTriangle(const CanvasTriangle &triangle, int width, int height, TriangleSetup &setup);
+    bool drawFilledTriangle(RenderTarget &target, const TriangleSetup &setup, uint32_t colour, const PixelBounds &tile, CullStats &stats);
 }
\ No newline at end of file